@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include "gss.h"
+#include "gss_array.h"
+#include "gss_module.h"
+#include "gss_profiler.h"
+#include "gss_scheduler.h"
+
+class BenchmarkMode
+{
+public:
+    const char* name;
+    bool register_backend;
+    bool jit;
+    unsigned int snapshot_interval; //When not zero, move the running script to a new engine after this many instructions.
+    bool fork; //Move to the new engine with fork() instead of snapshot/restore.
+};
+
+static const BenchmarkMode modes[] = {
+    {"stack", false, false, 0, false},
+    {"registers", true, false, 0, false},
+    {"stack+jit", false, true, 0, false},
+    {"registers+jit", true, true, 0, false},
+    {"snapshots", false, false, 100000, false},
+    {"forks", false, false, 100000, true},
+};
+
+class BenchmarkResult
+{
+public:
+    double time; //Milliseconds, including compiling the script.
+    uint64_t interpreted_instructions;
+    uint64_t ticks; //Backward jumps and calls, summed over all engines the script ran on.
+    GssMemoryStatistics memory; //Summed over all engines the script ran on.
+
+    BenchmarkResult() : time(0.0), interpreted_instructions(0), ticks(0) {}
+
+    void addMemoryStatistics(const GssMemoryStatistics& statistics)
+    {
+        memory.garbage_collect_count += statistics.garbage_collect_count;
+        memory.garbage_collect_time_ns += statistics.garbage_collect_time_ns;
+        memory.garbage_collect_max_pause_ns = std::max(memory.garbage_collect_max_pause_ns, statistics.garbage_collect_max_pause_ns);
+        memory.peak_heap_size = std::max(memory.peak_heap_size, statistics.peak_heap_size);
+        memory.peak_live_size = std::max(memory.peak_live_size, statistics.peak_live_size);
+    }
+};
+
+static unsigned int memory_size = 1024 * 1024;
+static bool lazy_compile = false;
+static GssModuleCache module_cache; //Shared by all modes, so an imported module is only compiled once per script.
+static unsigned int reload_count = 0;
+static GssScheduler* scheduler = nullptr; //Set while scheduleScript runs, with the task number of each engine.
+static std::unordered_map<GssEngine*, unsigned int> task_ids;
+static constexpr unsigned int schedule_task_count = 4;
+static std::string module_directory;
+
+static void setup(GssEngine& engine, const BenchmarkMode& mode, std::ostringstream& output)
+{
+    engine.setMemorySize(memory_size);
+    engine.setLazyCompile(lazy_compile);
+    engine.setModuleCache(&module_cache);
+    engine.setRegisterBackend(mode.register_backend);
+    //Compile functions on their first call, so as much code as possible runs natively and is compared against the interpreter.
+    engine.setJitEnabled(mode.jit, 1);
+    engine.addNativeFunction("print", [&output](GssNativeFunctionCallData& data)
+    {
+        for(int index=0; index<data.getParameterCount(); index++)
+        {
+            if (index > 0)
+                output << " ";
+            if (data.isInt(index))
+                output << data.getInt64(index);
+            else if (data.isFloat(index))
+                output << std::setprecision(15) << data.getDouble(index);
+            else if (data.isString(index))
+                output << data.getString(index);
+            else if (data.isNone(index))
+                output << "none";
+        }
+        output << std::endl;
+    });
+    //Cheap native function for the native call benchmark.
+    engine.addNativeFunction("abs", [](GssNativeFunctionCallData& data)
+    {
+        if (data.isInt(0))
+            data.returnInt64(std::abs(data.getInt64(0)));
+        else
+            data.returnDouble(std::abs(data.getDouble(0)));
+    });
+    engine.addNativeFunction("reload_count", [](GssNativeFunctionCallData& data)
+    {
+        data.returnInt(reload_count);
+    });
+    //Tasks for the scheduler test, see scheduleScript. Outside of it there are no tasks.
+    engine.addNativeFunction("task_count", [](GssNativeFunctionCallData& data)
+    {
+        data.returnInt(scheduler ? schedule_task_count : 0);
+    });
+    engine.addNativeFunction("task_id", [&engine](GssNativeFunctionCallData& data)
+    {
+        auto it = task_ids.find(&engine);
+        data.returnInt(it != task_ids.end() ? it->second : 0);
+    });
+    engine.addNativeFunction("scheduler_tick", [](GssNativeFunctionCallData& data)
+    {
+        data.returnInt64(scheduler ? scheduler->getTick() : 0);
+    });
+    engine.addNativeFunction("scheduler_signal", [](GssNativeFunctionCallData& data)
+    {
+        if (scheduler && data.isString(0))
+            scheduler->signal(data.getString(0));
+    });
+    GssArrayFunctions::addTo(engine);
+}
+
+static BenchmarkResult run(const string& code, const BenchmarkMode& mode, std::ostringstream& output)
+{
+    BenchmarkResult result;
+    std::unique_ptr<GssEngine> engine(new GssEngine());
+    setup(*engine, mode, output);
+
+    auto start = std::chrono::steady_clock::now();
+    if (!mode.snapshot_interval)
+    {
+        engine->compile(code);
+    }
+    else if (engine->load(code))
+    {
+        unsigned int snapshot_count = 0;
+        size_t snapshot_size = 0;
+        double snapshot_time = 0.0;
+        double image_time = 0.0; //Forks: the first fork after a run also creates the heap image, which is measured apart.
+        while(engine->run(mode.snapshot_interval))
+        {
+            std::unique_ptr<GssEngine> next;
+            if (mode.fork)
+            {
+                auto image_start = std::chrono::steady_clock::now();
+                std::unique_ptr<GssEngine> first_fork(engine->fork());
+                auto snapshot_start = std::chrono::steady_clock::now();
+                next.reset(engine->fork());
+                snapshot_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - snapshot_start).count();
+                image_time += std::chrono::duration<double, std::milli>(snapshot_start - image_start).count();
+            }else{
+                next.reset(new GssEngine());
+                setup(*next, mode, output);
+                next->load(code);
+
+                auto snapshot_start = std::chrono::steady_clock::now();
+                std::vector<uint8_t> data = engine->snapshot();
+                if (!next->restore(data))
+                    break;
+                snapshot_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - snapshot_start).count();
+                snapshot_size += data.size();
+            }
+            snapshot_count++;
+            result.ticks += engine->getUsage().ticks;
+            result.addMemoryStatistics(engine->getMemoryStatistics());
+            engine = std::move(next);
+        }
+        if (snapshot_count && mode.fork)
+            std::cout << "    " << snapshot_count << " forks, " << (image_time * 1000.0 / snapshot_count) << "us per heap image (GC and the first fork), " << (snapshot_time * 1000.0 / snapshot_count) << "us per fork from the image" << std::endl;
+        else if (snapshot_count)
+            std::cout << "    " << snapshot_count << " snapshots, " << (snapshot_size / snapshot_count) << " bytes and " << (snapshot_time * 1000.0 / snapshot_count) << "us per snapshot+restore" << std::endl;
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.time = std::chrono::duration<double, std::milli>(end - start).count();
+    result.interpreted_instructions = engine->getExecutedInstructionCount();
+    result.ticks += engine->getUsage().ticks;
+    result.addMemoryStatistics(engine->getMemoryStatistics());
+    std::cout << "  " << mode.name << ": " << engine->getInstructionCount() << " instructions, " << result.interpreted_instructions << " interpreted, " << result.ticks << " ticks, " << result.time << "ms";
+    if (lazy_compile)
+        std::cout << ", " << engine->getCompiledFunctionCount() << " of " << engine->getFunctionCount() << " functions compiled";
+    std::cout << std::endl;
+    return result;
+}
+
+static std::string jsonString(const std::string& str)
+{
+    std::string result = "\"";
+    for(char c : str)
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+/*
+    Work of a script is measured in ops: the instructions the plain stack interpreter executes for it.
+    All modes are measured against that same count, so their ns/op and ops/sec can be compared directly.
+*/
+static void report(const BenchmarkResult& result, uint64_t ops, const char* script, const BenchmarkMode& mode, bool output_matches, std::ostream& json)
+{
+    double ns_per_op = result.time * 1000000.0 / ops;
+    double gc_time = result.memory.garbage_collect_time_ns / 1000000.0;
+    double gc_max_pause = result.memory.garbage_collect_max_pause_ns / 1000000.0;
+    std::cout << "    " << (ops / result.time / 1000.0) << " Mops/s, " << ns_per_op << " ns/op, ";
+    std::cout << result.memory.garbage_collect_count << " GCs taking " << gc_time << "ms (max pause " << gc_max_pause << "ms), peak heap " << result.memory.peak_heap_size << " bytes, peak live " << result.memory.peak_live_size << " bytes" << std::endl;
+
+    if (json.tellp() > 0)
+        json << "," << std::endl;
+    json << "{\"script\": " << jsonString(script) << ", \"mode\": " << jsonString(mode.name);
+    json << ", \"time_ms\": " << result.time << ", \"ops\": " << ops << ", \"interpreted_instructions\": " << result.interpreted_instructions << ", \"ticks\": " << result.ticks;
+    json << ", \"ops_per_second\": " << (ops / result.time * 1000.0) << ", \"ns_per_op\": " << ns_per_op;
+    json << ", \"gc_count\": " << result.memory.garbage_collect_count << ", \"gc_time_ms\": " << gc_time << ", \"gc_max_pause_ms\": " << gc_max_pause;
+    json << ", \"peak_heap_bytes\": " << result.memory.peak_heap_size << ", \"peak_live_bytes\": " << result.memory.peak_live_size << ", \"output_matches\": " << (output_matches ? "true" : "false") << "}";
+}
+
+static void profile(const string& code, const char* filename)
+{
+    std::ostringstream output;
+    GssEngine engine;
+    setup(engine, modes[0], output);
+    GssProfiler profiler;
+    engine.setProfiler(&profiler, 100);
+    engine.compile(code);
+
+    std::cout << "  profile: " << profiler.getSampleCount() << " samples" << std::endl << profiler.getFlatProfile();
+    std::string folded_filename = std::string(filename) + ".folded";
+    std::ofstream folded(folded_filename);
+    folded << profiler.getFoldedStacks();
+    std::cout << "  folded stacks written to " << folded_filename << std::endl;
+}
+
+//When the file [filename] exists, it holds the known good output.
+static bool matchesExpected(const std::string& filename, const std::string& output)
+{
+    std::ifstream expected_file(filename);
+    if (!expected_file.is_open())
+        return true;
+    std::stringstream expected;
+    expected << expected_file.rdbuf();
+    if (expected.str() == output)
+        return true;
+    std::cout << "    output differs from " << filename << ":" << std::endl << expected.str();
+    return false;
+}
+
+/*
+    Run the script, then reload it [count] times and run it again each time, with the JIT. Every run needs to print the same
+    as the first one, and to run as much native code: the native code of the old program has to be dropped on each reload.
+*/
+static int reloadScript(const string& code, unsigned int count)
+{
+    std::ostringstream output;
+    GssEngine engine;
+    setup(engine, modes[3], output);
+    reload_count = 0;
+    engine.load(code);
+    engine.run();
+    std::string first_output = output.str();
+    uint64_t first_interpreted = engine.getExecutedInstructionCount();
+
+    int result = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(reload_count=1; reload_count<=count; reload_count++)
+    {
+        output.str("");
+        uint64_t interpreted = engine.getExecutedInstructionCount();
+        if (!engine.reload(code) || engine.run())
+        {
+            std::cout << "  reload " << reload_count << " failed" << std::endl;
+            result = 1;
+            break;
+        }
+        interpreted = engine.getExecutedInstructionCount() - interpreted;
+        if (output.str() != first_output || interpreted > first_interpreted)
+        {
+            std::cout << "  reload " << reload_count << " differs, " << interpreted << " instructions interpreted instead of " << first_interpreted << ":" << std::endl << output.str();
+            result = 1;
+            break;
+        }
+    }
+    double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << first_output << "  " << (reload_count - 1) << " reloads, " << (time * 1000.0 / std::max(1u, reload_count - 1)) << "us per reload and run" << std::endl;
+    reload_count = 0;
+    return result;
+}
+
+/*
+    Run the script as [schedule_task_count] tasks in a GssScheduler with ticks of 1/64 second, one tick per update, with both
+    compile backends and with and without the JIT. Each mode needs to print the same, and all tasks need to end within a fixed
+    number of updates. This covers scripts that continue after yield, wait and wait_event, which the other modes do not.
+*/
+static int scheduleScript(const string& code, const std::string& script)
+{
+    const unsigned int max_updates = 100000;
+    int result = 0;
+    std::string reference_output;
+    for(unsigned int mode_index=0; mode_index<4; mode_index++)
+    {
+        std::ostringstream output;
+        GssScheduler mode_scheduler(1.0 / 64.0);
+        std::vector<std::unique_ptr<GssEngine>> engines;
+        scheduler = &mode_scheduler;
+        for(unsigned int task_id=0; task_id<schedule_task_count; task_id++)
+        {
+            engines.emplace_back(new GssEngine());
+            setup(*engines.back(), modes[mode_index], output);
+            task_ids[engines.back().get()] = task_id;
+            if (engines.back()->load(code))
+                mode_scheduler.add(engines.back().get());
+        }
+        unsigned int update_count = 0;
+        while(mode_scheduler.getTaskCount() > 0 && update_count < max_updates)
+        {
+            mode_scheduler.update(1.0 / 64.0);
+            update_count++;
+        }
+        scheduler = nullptr;
+        task_ids.clear();
+
+        if (mode_index == 0)
+        {
+            reference_output = output.str();
+            std::cout << reference_output;
+            if (!matchesExpected(script + ".schedule.expected", reference_output))
+                result = 1;
+        }
+        std::cout << "  " << modes[mode_index].name << ": " << update_count << " updates" << std::endl;
+        if (update_count == max_updates)
+        {
+            std::cout << "    tasks did not end" << std::endl;
+            result = 1;
+        }
+        if (output.str() != reference_output)
+        {
+            std::cout << "    output differs from " << modes[0].name << ":" << std::endl << output.str();
+            result = 1;
+        }
+    }
+    return result;
+}
+
+/*
+    Compile [copies] copies of all scripts as one batch, on a single thread and then on all cores, like a game compiling
+    all its scripts at startup. Reports the average compile time of each script and the wall time of both batches.
+*/
+static int batchCompile(const std::vector<std::string>& filenames, const std::vector<std::string>& codes, unsigned int copies)
+{
+    std::vector<string> sources;
+    for(unsigned int copy=0; copy<copies; copy++)
+        sources.insert(sources.end(), codes.begin(), codes.end());
+    std::ostringstream output;
+    GssEngine engine;
+    setup(engine, modes[0], output);
+
+    double times[2];
+    std::vector<GssCompileResult> results;
+    for(unsigned int batch=0; batch<2; batch++)
+    {
+        module_cache.clear();
+        auto start = std::chrono::steady_clock::now();
+        results = engine.compileBatch(sources, batch == 0 ? 1 : 0);
+        times[batch] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    int result = 0;
+    for(unsigned int index=0; index<filenames.size(); index++)
+    {
+        double compile_time = 0.0;
+        for(unsigned int copy=0; copy<copies; copy++)
+        {
+            const GssCompileResult& compiled = results[copy * filenames.size() + index];
+            compile_time += compiled.compile_time;
+            if (!compiled.program)
+                result = 1;
+        }
+        std::cout << "  " << filenames[index] << ": " << (compile_time * 1000000.0 / copies) << "us per compile" << std::endl;
+    }
+    std::cout << sources.size() << " scripts, 1 thread: " << times[0] << "ms, " << std::max(1u, std::thread::hardware_concurrency()) << " threads: " << times[1] << "ms" << std::endl;
+    std::cout << "  speedup: " << (times[0] / times[1]) << "x" << std::endl;
+    return result;
+}
+
+/*
+    Small standalone runner for the benchmark scripts in this directory.
+    Runs each script with the stack and the register backend of the compiler, with and without the JIT.
+    The printed output of every mode is compared against the plain stack interpreter, any difference is a bug.
+    When there is a [script].expected file next to the script, the output of the stack interpreter needs to match it as well.
+    With --profile the scripts are only run once with the profiler, which writes [script].folded for flamegraph.pl.
+    With --memory the scripts get a heap of the given amount of bytes, for scripts with large data sets.
+    With --lazy function bodies are compiled on their first call.
+    With --json the results of every script and mode are also written to the given file, to track regressions between builds.
+    With --reload the scripts are run and then reloaded and run again the given number of times, see reloadScript.
+    With --schedule the scripts run as tasks in a GssScheduler, see scheduleScript. The output is compared against [script].schedule.expected.
+    With --batch the scripts are not run, but compiled together as a batch of the given number of copies of each, once on a single
+    thread and once on all cores.
+    Scripts import modules from the modules directory next to them.
+    Usage: gss_benchmark [--profile] [--memory bytes] [--lazy] [--json results.json] [--reload count] [--schedule] [--batch copies] [script.gss]...
+*/
+int main(int argc, char** argv)
+{
+    int result = 0;
+    bool profile_only = false;
+    std::string json_filename;
+    std::ostringstream json;
+    unsigned int batch_copies = 0;
+    unsigned int reload_times = 0;
+    bool schedule = false;
+    std::vector<std::string> batch_filenames;
+    std::vector<std::string> batch_codes;
+    module_cache.setLoader([](const string& name, string& code)
+    {
+        std::string filename = module_directory;
+        filename += name;
+        filename += ".gss";
+        std::ifstream file(filename);
+        if (!file.is_open())
+            return false;
+        std::stringstream module_code;
+        module_code << file.rdbuf();
+        code = module_code.str();
+        return true;
+    });
+    for(int n=1; n<argc; n++)
+    {
+        if (std::string(argv[n]) == "--profile")
+        {
+            profile_only = true;
+            continue;
+        }
+        if (std::string(argv[n]) == "--memory" && n + 1 < argc)
+        {
+            memory_size = std::stoul(argv[++n]);
+            continue;
+        }
+        if (std::string(argv[n]) == "--lazy")
+        {
+            lazy_compile = true;
+            continue;
+        }
+        if (std::string(argv[n]) == "--json" && n + 1 < argc)
+        {
+            json_filename = argv[++n];
+            continue;
+        }
+        if (std::string(argv[n]) == "--reload" && n + 1 < argc)
+        {
+            reload_times = std::stoul(argv[++n]);
+            continue;
+        }
+        if (std::string(argv[n]) == "--schedule")
+        {
+            schedule = true;
+            continue;
+        }
+        if (std::string(argv[n]) == "--batch" && n + 1 < argc)
+        {
+            batch_copies = std::max(1ul, std::stoul(argv[++n]));
+            continue;
+        }
+        std::ifstream file(argv[n]);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open: " << argv[n] << std::endl;
+            return 1;
+        }
+        std::stringstream code;
+        code << file.rdbuf();
+        std::string script = argv[n];
+        module_directory = script.substr(0, script.find_last_of('/') + 1) + "modules/";
+        module_cache.clear();
+        if (batch_copies)
+        {
+            batch_filenames.push_back(script);
+            batch_codes.push_back(code.str());
+            continue;
+        }
+
+        std::cout << argv[n] << std::endl;
+        if (reload_times)
+        {
+            if (reloadScript(code.str(), reload_times))
+                result = 1;
+            continue;
+        }
+        if (schedule)
+        {
+            if (scheduleScript(code.str(), script))
+                result = 1;
+            continue;
+        }
+        if (profile_only)
+        {
+            profile(code.str(), argv[n]);
+            continue;
+        }
+        std::string reference_output;
+        BenchmarkResult reference;
+        for(const BenchmarkMode& mode : modes)
+        {
+            std::ostringstream output;
+            BenchmarkResult mode_result = run(code.str(), mode, output);
+            bool output_matches = true;
+            if (&mode == &modes[0])
+            {
+                reference_output = output.str();
+                reference = mode_result;
+                std::cout << reference_output;
+                if (!matchesExpected(script + ".expected", reference_output))
+                {
+                    output_matches = false;
+                    result = 1;
+                }
+            }else{
+                std::cout << "    speedup: " << (reference.time / mode_result.time) << "x" << std::endl;
+                if (output.str() != reference_output)
+                {
+                    std::cout << "    output differs from " << modes[0].name << ":" << std::endl << output.str();
+                    output_matches = false;
+                    result = 1;
+                }
+            }
+            report(mode_result, std::max<uint64_t>(reference.interpreted_instructions, 1), argv[n], mode, output_matches, json);
+        }
+    }
+    if (batch_copies)
+        result = batchCompile(batch_filenames, batch_codes, batch_copies);
+    if (!json_filename.empty())
+    {
+        std::ofstream json_file(json_filename);
+        json_file << "[" << std::endl << json.str() << std::endl << "]" << std::endl;
+    }
+    return result;
+}
@@ -1,20 +1,138 @@
 #include "gss.h"
 #include "gss_tokenizer.h"
 #include "gss_compiler.h"
+#include "gss_jit.h"
+#include "gss_snapshot.h"
+#include "gss_profiler.h"
 
 #include "logging.h"
 
+#include <atomic>
+#include <map>
+#include <thread>
+
+static constexpr uint32_t snapshot_magic = 0x36535347; //"GSS6", version 6 stores the globals outside of the heap.
+static constexpr int64_t tick_check_interval = 10000; //Ticks between checks of the run time limit.
+
+GssEngine::GssEngine()
+: memory(nullptr), memory_size(1024*1024), register_backend(false), lazy_compile(false), module_cache(nullptr), executed_instruction_count(0), jit(nullptr), jit_enabled(false), jit_call_threshold(100), tick_budget(tick_check_interval), tick_budget_start(tick_check_interval), profiler(nullptr), profiler_interval(1000), next_profiler_sample(0), program(std::make_shared<GssProgram>()), wait_reason(GssWaitReason::none), wait_time(0.0)
+{
+}
+
+GssEngine::~GssEngine()
+{
+    delete jit;
+    delete memory;
+}
+
 void GssEngine::compile(string code)
+{
+    if (!load(code))
+        return;
+    run();
+    LOG(INFO) << "Free memory: " << memory->getFreeMemoryAmount();
+}
+
+bool GssEngine::load(string code)
+{
+    unload();
+    std::shared_ptr<GssProgram> new_program = compileProgram(code, nullptr);
+    if (!new_program)
+        return false;
+    return load(std::shared_ptr<const GssProgram>(new_program));
+}
+
+bool GssEngine::load(std::shared_ptr<const GssProgram> new_program)
+{
+    unload();
+    //The program refers to the native functions by global index, so they need to be the same as the ones it was compiled with.
+    bool natives_match = new_program->native_function_count == native_functions.size();
+    for(unsigned int index=0; natives_match && index<native_functions.size(); index++)
+        natives_match = new_program->global_names[index] == native_functions[index].name;
+    if (!natives_match)
+    {
+        LOG(ERROR) << "Cannot load a program that was compiled with other native functions";
+        return false;
+    }
+    program = new_program;
+    function_call_counts.assign(program->functions.size(), 0);
+    jit_entry_points.assign(program->code.size(), nullptr);
+    resetInlineCaches();
+    
+    delete memory;
+    memory = new GssMemory(memory_size);
+    memory->setHeapLimit(limits.max_heap_size);
+    memory->setGlobalCount(program->global_names.size());
+    
+    for(unsigned int index=0; index<native_functions.size(); index++)
+    {
+        GssVariant* v = memory->getGlobal(index);
+        v->setReference(GssVariant::Type::native_function, index);
+    }
+    return true;
+}
+
+void GssEngine::unload()
 {
     instruction_pointer = 0;
     locals_stack_position = 0;
-    
+    call_stack.clear();
+    executed_instruction_count = 0;
+    usage = GssUsage();
+    resetTickBudget();
+    program = std::make_shared<GssProgram>();
+    reloaded_program = nullptr;
+    kept_globals.clear();
+    memory_image = nullptr;
+    jit_entry_points.clear();
+    if (jit)
+        jit->reset();
+}
+
+bool GssEngine::reload(string code)
+{
+    if (!memory)
+        return load(code);
+    std::shared_ptr<GssProgram> new_program = compileProgram(code, program.get());
+    if (!new_program)
+        return false;
+    reloaded_program = new_program;
+    return true;
+}
+
+/*
+    Compile the code into a new program, errors are logged and return nullptr.
+    With a [previous_program] its strings keep their index in the new string table,
+    as the shapes of the dictionaries in the heap refer to member names by string table index.
+*/
+std::shared_ptr<GssProgram> GssEngine::compileProgram(string code, const GssProgram* previous_program)
+{
     try
     {
-        GssTokenizer tokenizer(code);
-        GssCompiler compiler(tokenizer);
-        compiler.setNativeFunctions(native_functions);
-        compiler.compile();
+        return buildProgram(code, previous_program, true);
+    }catch(GssTokenizerException e)
+    {
+        LOG(ERROR) << e.message;
+    }catch(GssCompilerException e)
+    {
+        LOG(ERROR) << e.message;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<GssProgram> GssEngine::buildProgram(string code, const GssProgram* previous_program, bool log_code)
+{
+    GssTokenizer tokenizer(code);
+    GssCompiler compiler(tokenizer);
+    compiler.setNativeFunctions(native_functions);
+    compiler.setRegisterBackend(register_backend);
+    compiler.setLazyFunctions(lazy_compile);
+    compiler.setModuleCache(module_cache);
+    if (previous_program)
+        compiler.string_table = previous_program->string_table;
+    compiler.compile();
+    if (log_code)
+    {
         LOG(INFO) << "----------------";
         int idx = 0;
         for(const GssInstruction& i : compiler.instructions)
@@ -23,42 +141,499 @@ void GssEngine::compile(string code)
             idx++;
         }
         LOG(INFO) << "----------------";
-        instructions = compiler.instructions;
-        string_table = compiler.string_table;
-    }catch(GssTokenizerException e)
+    }
+    std::shared_ptr<GssProgram> new_program = std::make_shared<GssProgram>();
+    new_program->code.encode(compiler.instructions);
+    if (log_code)
+        LOG(INFO) << "Code: " << new_program->code.size() << " words, " << new_program->code.getWideOperandCount() << " wide operands";
+    new_program->string_table = compiler.string_table;
+    new_program->number_table = compiler.number_table;
+    new_program->functions = compiler.functions;
+    new_program->global_names = compiler.global_vars;
+    new_program->native_function_count = native_functions.size();
+    new_program->debug_info = compiler.debug_info;
+    new_program->lazy_source = compiler.lazy_source;
+    if (new_program->lazy_source)
+        new_program->lazy_source->code = code;
+    return new_program;
+}
+
+/*
+    Scripts are handed out one at a time from a shared counter, so threads that get small scripts take more of them.
+    The instruction listing is not logged, the listings of many scripts at once would only be interleaved noise.
+*/
+std::vector<GssCompileResult> GssEngine::compileBatch(const std::vector<string>& sources, unsigned int thread_count)
+{
+    std::vector<GssCompileResult> results(sources.size());
+    std::atomic<unsigned int> next_index(0);
+    auto worker = [this, &sources, &results, &next_index]()
     {
-        LOG(ERROR) << e.message;
-        return;
-    }catch(GssCompilerException e)
+        for(unsigned int index = next_index++; index < sources.size(); index = next_index++)
+        {
+            GssCompileResult& result = results[index];
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                result.program = buildProgram(sources[index], nullptr, false);
+            }catch(GssTokenizerException e)
+            {
+                result.error = e.message;
+            }catch(GssCompilerException e)
+            {
+                result.error = e.message;
+            }
+            result.compile_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!result.program)
+                LOG(ERROR) << "Script " << index << ": " << result.error;
+        }
+    };
+
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min<unsigned int>(thread_count, sources.size());
+    //The calling thread is one of the workers.
+    std::vector<std::thread> threads;
+    for(unsigned int index=1; index<thread_count; index++)
+        threads.emplace_back(worker);
+    worker();
+    for(std::thread& thread : threads)
+        thread.join();
+    return results;
+}
+
+/*
+    Append the body of a lazy function to the program, the function table entry moves from the stub to the body.
+    The body is compiled on its own and appended in place, so a compile only costs the size of the function. A program that
+    other engines use as well is copied first, and the copy is then only used by this engine for further compiles.
+    Throws the compiler and tokenizer exceptions, the function keeps its stub then.
+*/
+void GssEngine::compileLazyFunction(std::shared_ptr<const GssProgram>& program, unsigned int function_index)
+{
+    if (program.use_count() > 1)
     {
-        LOG(ERROR) << e.message;
-        return;
+        std::shared_ptr<GssProgram> copy = std::make_shared<GssProgram>();
+        copy->code.copyFrom(program->code);
+        copy->string_table = program->string_table;
+        copy->number_table = program->number_table;
+        copy->functions = program->functions;
+        copy->global_names = program->global_names;
+        copy->native_function_count = program->native_function_count;
+        copy->debug_info = program->debug_info;
+        copy->lazy_source = program->lazy_source;
+        copy->lazy_compiled_functions = program->lazy_compiled_functions;
+        program = copy;
     }
-    
-    memory = new GssMemory(1024*1024);
-    
-    for(unsigned int index=0; index<native_functions.size(); index++)
+    //Only this engine refers to the program now, and it was created as a non-const GssProgram.
+    GssProgram& target = const_cast<GssProgram&>(*program);
+    const GssLazyFunction& lazy_function = target.lazy_source->functions[function_index];
+    GssTokenizer tokenizer(target.lazy_source->code, lazy_function.body_position);
+    GssCompiler compiler(tokenizer);
+    //The tables are moved into the compiler and back, new strings and numbers are only added at the end.
+    compiler.string_table = std::move(target.string_table);
+    compiler.number_table = std::move(target.number_table);
+    compiler.functions = std::move(target.functions);
+    compiler.global_vars = std::move(target.global_names);
+    compiler.lazy_source = target.lazy_source;
+    auto moveTablesBack = [&target, &compiler]()
     {
-        GssVariant* v = memory->getGlobal(index);
-        v->type = GssVariant::Type::native_function;
-        v->data.i = index;
+        target.string_table = std::move(compiler.string_table);
+        target.number_table = std::move(compiler.number_table);
+        target.functions = std::move(compiler.functions);
+        target.global_names = std::move(compiler.global_vars);
+    };
+    unsigned int base_address = target.code.size();
+    GssFunctionInfo stub = compiler.functions[function_index];
+    try
+    {
+        compiler.compileFunction(function_index, base_address);
+    }catch(...)
+    {
+        compiler.functions[function_index] = stub;
+        moveTablesBack();
+        throw;
+    }
+    moveTablesBack();
+    target.code.append(compiler.instructions);
+    target.debug_info.append(compiler.instruction_lines, base_address, function_index);
+    target.lazy_compiled_functions.push_back(function_index);
+}
+
+/*
+    Replace the program by the reloaded one. Only called while no script function is active,
+    as call frames hold instruction pointers into the old program.
+*/
+void GssEngine::switchToReloadedProgram()
+{
+    std::shared_ptr<const GssProgram> old_program = program;
+    program = reloaded_program;
+    reloaded_program = nullptr;
+
+    std::map<string, unsigned int> old_global_indices;
+    for(unsigned int index=0; index<old_program->global_names.size(); index++)
+        old_global_indices.emplace(old_program->global_names[index], index);
+    std::map<string, unsigned int> function_indices;
+    for(unsigned int index=0; index<program->functions.size(); index++)
+        function_indices.emplace(program->functions[index].name, index);
+
+    unsigned int old_global_count = old_program->global_names.size();
+    unsigned int global_count = program->global_names.size();
+    std::vector<GssVariant> old_values(memory->getGlobals(), memory->getGlobals() + old_global_count);
+    memory->setGlobalCount(0);
+    memory->setGlobalCount(global_count);
+
+    kept_globals.assign(global_count, false);
+    unsigned int kept_count = 0;
+    for(unsigned int index=0; index<global_count; index++)
+    {
+        GssVariant* global = memory->getGlobal(index);
+        auto it = old_global_indices.find(program->global_names[index]);
+        if (it == old_global_indices.end())
+            continue;
+        GssVariant value = old_values[it->second];
+        if (value.is(GssVariant::Type::script_function))
+        {
+            //Script functions are referenced by index, find the function with the same name in the new program.
+            auto function = function_indices.find(old_program->functions[value.getReference()].name);
+            if (function == function_indices.end())
+                continue;
+            value.setReference(GssVariant::Type::script_function, function->second);
+        }
+        *global = value;
+        kept_globals[index] = true;
+        kept_count++;
+    }
+
+    //The global code starts over, temporaries of the old global code are dropped from the stack.
+    memory->setStackSize(0);
+    instruction_pointer = 0;
+    locals_stack_position = 0;
+    memory_image = nullptr;
+    function_call_counts.assign(program->functions.size(), 0);
+    jit_entry_points.assign(program->code.size(), nullptr);
+    //The native code of the old program is never entered again.
+    if (jit)
+        jit->reset();
+    resetInlineCaches();
+    LOG(INFO) << "Reloaded program, kept " << kept_count << " of " << global_count << " globals";
+}
+
+bool GssEngine::run(uint64_t max_instructions)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    run_deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(limits.max_run_time));
+    bool result = runProgram(max_instructions);
+    usage.run_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    usage.run_count++;
+    return result;
+}
+
+bool GssEngine::runProgram(uint64_t max_instructions)
+{
+    //Between run() calls nothing refers to the instructions of the old program, except the call frames of active functions.
+    if (reloaded_program && memory && call_stack.empty())
+        switchToReloadedProgram();
+    wait_reason = GssWaitReason::none;
+    if (!isRunning())
+        return false;
+    memory_image = nullptr;
+    uint64_t instruction_limit = max_instructions ? executed_instruction_count + max_instructions : std::numeric_limits<uint64_t>::max();
+    //Single check in the loop for both the instruction limit and the next profiler sample.
+    uint64_t next_stop = instruction_limit;
+    if (profiler)
+    {
+        next_profiler_sample = executed_instruction_count + profiler_interval;
+        next_stop = std::min(next_stop, next_profiler_sample);
     }
-    
     try
     {
-        while(instruction_pointer < instructions.size())
+        //A lazily compiled function grows the program, and continues at its body past the old end, which ends the inner loop.
+        while(instruction_pointer < program->code.size())
         {
-            step();
+            //Local copies, so the loop below does not need to reload these from the engine on each instruction.
+            const unsigned int instruction_count = program->code.size();
+            const void* const* entry_points = (jit_enabled && !profiler) ? jit_entry_points.data() : nullptr;
+            while(instruction_pointer < instruction_count)
+            {
+                if (executed_instruction_count >= next_stop)
+                {
+                    if (executed_instruction_count >= instruction_limit)
+                    {
+                        return true;
+                    }else{
+                        takeProfilerSample();
+                        next_profiler_sample = executed_instruction_count + profiler_interval;
+                        next_stop = std::min(instruction_limit, next_profiler_sample);
+                    }
+                }
+                if (entry_points && entry_points[instruction_pointer])
+                {
+                    instruction_pointer = runNativeCode(entry_points[instruction_pointer]);
+                    if (instruction_pointer >= instruction_count)
+                        break;
+                }
+                step();
+            }
+        }
+        if (wait_reason != GssWaitReason::none)
+        {
+            instruction_pointer = resume_instruction_pointer;
+            return true;
         }
         LOG(INFO) << "Finished";
     }catch(GssRuntimeException e)
     {
-        LOG(ERROR) << e.message;
+        LOG(ERROR) << e.message << getStackTrace();
+        stopAfterError();
     }catch(GssMemoryException e)
     {
-        LOG(ERROR) << e.message;
+        if (e.heap_limit)
+            usage.exceeded = GssLimit::heap_size;
+        LOG(ERROR) << e.message << getStackTrace();
+        stopAfterError();
     }
-    LOG(INFO) << "Free memory: " << memory->getFreeMemoryAmount();
+    return false;
+}
+
+//The script ends, and the calls that were active are dropped, so a reload can take over on the next run().
+void GssEngine::stopAfterError()
+{
+    instruction_pointer = program->code.size();
+    if (!call_stack.empty())
+        memory->releaseScratch(call_stack.front().scratch_position);
+    call_stack.clear();
+    locals_stack_position = 0;
+}
+
+bool GssEngine::isRunning()
+{
+    return memory && instruction_pointer < program->code.size();
+}
+
+std::vector<uint8_t> GssEngine::snapshot()
+{
+    std::vector<uint8_t> data;
+    if (!memory)
+        return data;
+    GssSnapshotWriter writer(data);
+    writer.writeUInt32(snapshot_magic);
+    writer.writeUInt32(program->lazy_compiled_functions.size());
+    for(unsigned int function_index : program->lazy_compiled_functions)
+        writer.writeUInt32(function_index);
+    writer.writeUInt32(getProgramChecksum(*program));
+    writer.writeUInt32(instruction_pointer);
+    writer.writeUInt32(call_stack.size());
+    for(GssCallFrame& frame : call_stack)
+    {
+        writer.writeUInt32(frame.return_instruction_pointer);
+        writer.writeUInt32(frame.locals_stack_position);
+        writer.writeUInt32(frame.function_index);
+        writer.writeUInt32(frame.scratch_position);
+    }
+    writer.writeUInt32(kept_globals.size());
+    for(bool kept : kept_globals)
+        writer.writeUInt32(kept);
+    memory->writeSnapshot(writer);
+    return data;
+}
+
+bool GssEngine::restore(const std::vector<uint8_t>& data)
+{
+    if (!memory)
+    {
+        LOG(ERROR) << "Cannot restore a snapshot without a loaded program";
+        return false;
+    }
+    try
+    {
+        GssSnapshotReader reader(data);
+        if (reader.readUInt32() != snapshot_magic)
+            throw GssSnapshotException("Data is not a script snapshot");
+        //Compile the same lazy functions in the same order as the engine that made the snapshot, so the instructions match.
+        std::shared_ptr<const GssProgram> new_program = program;
+        std::vector<unsigned int> lazy_compiled_functions;
+        lazy_compiled_functions.resize(reader.readUInt32());
+        for(unsigned int& function_index : lazy_compiled_functions)
+            function_index = reader.readUInt32();
+        if (lazy_compiled_functions.size() < program->lazy_compiled_functions.size() || !std::equal(program->lazy_compiled_functions.begin(), program->lazy_compiled_functions.end(), lazy_compiled_functions.begin()))
+            throw GssSnapshotException("Snapshot was made with a different program");
+        for(unsigned int index=program->lazy_compiled_functions.size(); index<lazy_compiled_functions.size(); index++)
+        {
+            if (!new_program->lazy_source || lazy_compiled_functions[index] >= new_program->functions.size())
+                throw GssSnapshotException("Snapshot was made with a different program");
+            try
+            {
+                compileLazyFunction(new_program, lazy_compiled_functions[index]);
+            }catch(GssTokenizerException e)
+            {
+                throw GssSnapshotException(e.message);
+            }catch(GssCompilerException e)
+            {
+                throw GssSnapshotException(e.message);
+            }
+        }
+        if (reader.readUInt32() != getProgramChecksum(*new_program))
+            throw GssSnapshotException("Snapshot was made with a different program");
+        unsigned int new_instruction_pointer = reader.readUInt32();
+        if (new_instruction_pointer > new_program->code.size())
+            throw GssSnapshotException("Snapshot instruction pointer out of range");
+        std::vector<GssCallFrame> new_call_stack;
+        new_call_stack.resize(reader.readUInt32());
+        for(GssCallFrame& frame : new_call_stack)
+        {
+            frame.return_instruction_pointer = reader.readUInt32();
+            frame.locals_stack_position = reader.readUInt32();
+            frame.function_index = reader.readUInt32();
+            frame.scratch_position = reader.readUInt32();
+            if (frame.function_index >= new_program->functions.size() || frame.return_instruction_pointer > new_program->code.size())
+                throw GssSnapshotException("Snapshot call frame out of range");
+        }
+        std::vector<bool> new_kept_globals;
+        new_kept_globals.resize(reader.readUInt32());
+        if (new_kept_globals.size() > new_program->global_names.size())
+            throw GssSnapshotException("Snapshot has more globals than the program");
+        for(unsigned int index=0; index<new_kept_globals.size(); index++)
+            new_kept_globals[index] = reader.readUInt32();
+        std::unique_ptr<GssMemorySnapshot> memory_snapshot = memory->readSnapshot(reader);
+        if (memory_snapshot->getGlobalCount() != new_program->global_names.size())
+            throw GssSnapshotException("Snapshot globals do not match the program");
+        if (!reader.atEnd())
+            throw GssSnapshotException("Snapshot has trailing data");
+
+        //All of the snapshot is valid, only now the state of the engine changes.
+        memory->applySnapshot(std::move(memory_snapshot));
+        memory_image = nullptr;
+        program = new_program;
+        jit_entry_points.resize(program->code.size(), nullptr);
+        instruction_pointer = new_instruction_pointer;
+        call_stack = std::move(new_call_stack);
+        kept_globals = std::move(new_kept_globals);
+        locals_stack_position = call_stack.empty() ? 0 : call_stack.back().locals_stack_position;
+        //The shape table was replaced by the one in the snapshot.
+        resetInlineCaches();
+    }catch(GssSnapshotException e)
+    {
+        LOG(ERROR) << "Failed to restore snapshot: " << e.message;
+        return false;
+    }
+    return true;
+}
+
+GssEngine* GssEngine::fork()
+{
+    if (!memory)
+        return nullptr;
+    if (!memory_image)
+        memory_image = memory->createImage();
+
+    GssEngine* engine = new GssEngine();
+    engine->native_functions = native_functions;
+    engine->memory_size = memory_size;
+    engine->register_backend = register_backend;
+    engine->lazy_compile = lazy_compile;
+    engine->module_cache = module_cache;
+    engine->setJitEnabled(jit_enabled, jit_call_threshold);
+    engine->limits = limits;
+    engine->program = program;
+    engine->reloaded_program = reloaded_program;
+    engine->kept_globals = kept_globals;
+    engine->function_call_counts.assign(program->functions.size(), 0);
+    engine->jit_entry_points.assign(program->code.size(), nullptr);
+    engine->inline_caches = inline_caches; //The shape table is copied with the memory image, so the cached shapes stay valid.
+    engine->memory = new GssMemory(memory_image);
+    engine->memory->setHeapLimit(limits.max_heap_size);
+    engine->instruction_pointer = instruction_pointer;
+    engine->locals_stack_position = locals_stack_position;
+    engine->call_stack = call_stack;
+    return engine;
+}
+
+void GssEngine::setModuleCache(GssModuleCache* cache)
+{
+    module_cache = cache;
+}
+
+void GssEngine::setLimits(const GssLimits& limits)
+{
+    usage.ticks += tick_budget_start - tick_budget;
+    this->limits = limits;
+    resetTickBudget();
+    if (memory)
+        memory->setHeapLimit(limits.max_heap_size);
+}
+
+GssUsage GssEngine::getUsage()
+{
+    GssUsage result = usage;
+    result.ticks += tick_budget_start - tick_budget;
+    result.instructions = executed_instruction_count;
+    result.memory = getMemoryStatistics();
+    return result;
+}
+
+void GssEngine::checkLimits()
+{
+    usage.ticks += tick_budget_start - tick_budget;
+    tick_budget_start = tick_budget;
+    if (limits.max_ticks && usage.ticks > limits.max_ticks)
+    {
+        usage.exceeded = GssLimit::ticks;
+        throw GssRuntimeException("Script went over its tick limit");
+    }
+    if (limits.max_run_time > 0.0 && std::chrono::steady_clock::now() > run_deadline)
+    {
+        usage.exceeded = GssLimit::run_time;
+        throw GssRuntimeException("Script went over its run time limit");
+    }
+    resetTickBudget();
+}
+
+void GssEngine::resetTickBudget()
+{
+    tick_budget = tick_check_interval;
+    if (limits.max_ticks)
+        tick_budget = std::min(tick_budget, int64_t(limits.max_ticks - std::min(usage.ticks, limits.max_ticks)));
+    tick_budget_start = tick_budget;
+}
+
+void GssEngine::setProfiler(GssProfiler* profiler, unsigned int interval)
+{
+    this->profiler = profiler;
+    profiler_interval = std::max(1u, interval);
+}
+
+void GssEngine::takeProfilerSample()
+{
+    std::vector<unsigned int> stack;
+    stack.reserve(call_stack.size() + 1);
+    for(const GssCallFrame& frame : call_stack)
+        stack.push_back(frame.return_instruction_pointer - 1);
+    stack.push_back(instruction_pointer);
+    profiler->addSample(program, stack);
+}
+
+uint32_t GssEngine::getProgramChecksum(const GssProgram& program)
+{
+    //FNV-1a over the instructions, enough to detect a snapshot from another program or compiler version.
+    uint32_t hash = 2166136261u;
+    for(unsigned int index=0; index<program.code.size(); index++)
+    {
+        GssInstruction instruction = program.code.decode(index);
+        hash = (hash ^ uint32_t(instruction.type)) * 16777619u;
+        hash = (hash ^ uint32_t(instruction.data.i)) * 16777619u;
+    }
+    for(const string& str : program.string_table)
+    {
+        for(char c : str)
+            hash = (hash ^ uint8_t(c)) * 16777619u;
+    }
+    for(double number : program.number_table)
+    {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        hash = (hash ^ uint32_t(bits)) * 16777619u;
+        hash = (hash ^ uint32_t(bits >> 32)) * 16777619u;
+    }
+    return hash;
 }
 
 void GssEngine::addNativeFunction(string name, std::function<void(GssNativeFunctionCallData&)> function)
@@ -66,9 +641,31 @@ void GssEngine::addNativeFunction(string name, std::function<void(GssNativeFunct
     native_functions.emplace_back(name, function);
 }
 
+void GssEngine::setMemorySize(unsigned int size)
+{
+    memory_size = size;
+}
+
+void GssEngine::setLazyCompile(bool enabled)
+{
+    lazy_compile = enabled;
+}
+
+void GssEngine::setRegisterBackend(bool enabled)
+{
+    register_backend = enabled;
+}
+
+void GssEngine::setJitEnabled(bool enabled, unsigned int call_threshold)
+{
+    jit_enabled = enabled && GssJit::isSupported();
+    jit_call_threshold = call_threshold;
+}
+
 void GssEngine::step()
 {
-    GssInstruction& instruction = instructions[instruction_pointer];
+    const GssInstruction instruction = program->code.decode(instruction_pointer);
+    executed_instruction_count++;
     //LOG(DEBUG) << memory->getStackSize() << ":" << locals_stack_position << ":" << instruction.toString();
     switch(instruction.type)
     {
@@ -76,54 +673,70 @@ void GssEngine::step()
         break;
     case GssInstruction::Type::push_none:
         {
-            GssVariant* v = memory->appendStack();
-            v->type = GssVariant::Type::none;
+            memory->appendStack()->setNone();
         }
         break;
     case GssInstruction::Type::push_int:
         {
-            GssVariant* v = memory->appendStack();
-            v->type = GssVariant::Type::integer;
-            v->data.i = instruction.data.i;
+            memory->appendStack()->setInteger(instruction.data.i);
         }
         break;
     case GssInstruction::Type::push_float:
         {
-            GssVariant* v = memory->appendStack();
-            v->type = GssVariant::Type::float_value;
-            v->data.f = instruction.data.f;
+            memory->appendStack()->setDouble(program->number_table[instruction.data.i]);
+        }
+        break;
+    case GssInstruction::Type::push_wide_int:
+        {
+            memory->appendStack()->setInteger(int64_t(program->number_table[instruction.data.i]));
         }
         break;
     case GssInstruction::Type::push_empty_list:
         {
             memory->appendStack();
             unsigned int list_position = memory->createList(16);
-            GssVariant* v = memory->getStack(-1);
-            v->type = GssVariant::Type::list;
-            v->data.i = list_position;
+            memory->getStack(-1)->setReference(GssVariant::Type::list, list_position);
+        }
+        break;
+    case GssInstruction::Type::push_scratch_list:
+        {
+            //The current call is the last one that reserved scratch room, so its room starts at the scratch point.
+            unsigned int list_position = memory->createScratchList(memory->getScratchPoint() + instruction.getScratchOffset(), instruction.getScratchLength());
+            memory->appendStack()->setReference(GssVariant::Type::list, list_position);
+        }
+        break;
+    case GssInstruction::Type::push_empty_dictionary:
+        {
+            memory->appendStack()->setNone();
+            unsigned int dictionary_position = memory->createDictionary(instruction.data.i);
+            memory->getStack(-1)->setReference(GssVariant::Type::dictionary, dictionary_position);
         }
         break;
     case GssInstruction::Type::push_string_from_string_table:
         {
             GssVariant* v = memory->appendStack();
-            v->type = GssVariant::Type::string;
-            v->data.i = memory->createString(string_table[instruction.data.i]);
+            v->setNone();
+            unsigned int string_position = memory->createString(program->string_table[instruction.data.i]);
+            //createString can GC, which moves the stack.
+            memory->getStack(-1)->setReference(GssVariant::Type::string, string_position);
         }
         break;
     case GssInstruction::Type::push_script_function:
         {
-            GssVariant* v = memory->appendStack();
-            v->type = GssVariant::Type::script_function;
-            v->data.i = instruction.data.i;
+            memory->appendStack()->setReference(GssVariant::Type::script_function, instruction.data.i);
         }
         break;
     case GssInstruction::Type::jump:
+        if (unsigned(instruction.data.i) <= instruction_pointer)
+            tick();
         instruction_pointer = instruction.data.i;
         return;
     case GssInstruction::Type::jump_if_zero:
         if (memory->getStack(-1)->isZero())
         {
             memory->popStack();
+            if (unsigned(instruction.data.i) <= instruction_pointer)
+                tick();
             instruction_pointer = instruction.data.i;
             return;
         }
@@ -133,28 +746,87 @@ void GssEngine::step()
         if (!memory->getStack(-1)->isZero())
         {
             memory->popStack();
+            if (unsigned(instruction.data.i) <= instruction_pointer)
+                tick();
             instruction_pointer = instruction.data.i;
             return;
         }
         memory->popStack();
         break;
+    case GssInstruction::Type::jump_if_global_kept:
+        {
+            //The skipped initializer ends with the assign to the global.
+            unsigned int global_index = program->code.decode(instruction.data.i - 1).data.i;
+            if (global_index < kept_globals.size() && kept_globals[global_index])
+            {
+                instruction_pointer = instruction.data.i;
+                return;
+            }
+        }
+        break;
     case GssInstruction::Type::pop:
         memory->popStack();
         break;
+    case GssInstruction::Type::suspend:
+        {
+            GssWaitReason reason = GssWaitReason(instruction.data.i);
+            if (reason == GssWaitReason::time)
+            {
+                GssVariant* v = memory->getStack(-1);
+                if (!v->isNumber())
+                    throw GssRuntimeException("Tried to wait for non-number: " + v->toString());
+                wait_time = v->toDouble();
+                memory->popStack();
+            }else if (reason == GssWaitReason::event)
+            {
+                GssVariant* v = memory->getStack(-1);
+                if (!v->is(GssVariant::Type::string))
+                    throw GssRuntimeException("Tried to wait for event with non-string name: " + v->toString());
+                wait_event = memory->getString(v->getReference());
+                memory->popStack();
+            }
+            wait_reason = reason;
+            //Leave the run() loop without checking for a suspend on every instruction.
+            resume_instruction_pointer = instruction_pointer + 1;
+            instruction_pointer = program->code.size();
+        }
+        return;
+    case GssInstruction::Type::iterator_start:
+        {
+            GssVariant* list_v = memory->getStack(-1);
+            if (!list_v->is(GssVariant::Type::list))
+                throw GssRuntimeException("Tried to iterate over non-list type: " + list_v->toString());
+            memory->appendStack()->setInteger(0);
+        }
+        break;
+    case GssInstruction::Type::iterator_next:
+        {
+            //Stack: list, index. The list type was checked by iterator_start.
+            GssVariant* index = memory->getStack(-1);
+            GssList* list = memory->getList(memory->getStack(-2)->getReference());
+            uint32_t position = index->getInteger();
+            if (position >= list->current_length)
+            {
+                instruction_pointer = instruction.data.i;
+                return;
+            }
+            index->setInteger(position + 1);
+            GssVariant entry = memory->getListEntries(list)[position];
+            //appendStack can GC, so the entry is copied out first.
+            *memory->appendStack() = entry;
+        }
+        break;
 
     case GssInstruction::Type::push_global_by_index:
         {
-            //First increase the stack, but ignore this reference, as it could be invalidated by getGlobal. So get a new reference after this which is garanteed to be valid, as getStack does not trigger gc.
-            memory->appendStack();
-            GssVariant* source = memory->getGlobal(instruction.data.i);
-            GssVariant* target = memory->getStack(-1);
-            *target = *source;
+            //The globals are not in the heap, so the global stays valid when appendStack runs the GC.
+            GssVariant* target = memory->appendStack();
+            *target = *memory->getGlobal(instruction.data.i);
         }
         break;
     case GssInstruction::Type::assign_global_by_index:
         {
-            GssVariant* global = memory->getGlobal(instruction.data.i);
-            *global = *memory->getStack(-1);
+            *memory->getGlobal(instruction.data.i) = *memory->getStack(-1);
             memory->popStack();
         }
         break;
@@ -179,11 +851,16 @@ void GssEngine::step()
         {
             GssVariant* position = memory->getStack(-1);
             GssVariant* list_v = memory->getStack(-2);
-            if (list_v->type != GssVariant::Type::list)
-                throw GssRuntimeException("Tried to index non-list type: " + list_v->toString());
-            if (position->type != GssVariant::Type::integer)
+            if (!list_v->is(GssVariant::Type::list))
+            {
+                if (!list_v->is(GssVariant::Type::array))
+                    throw GssRuntimeException("Tried to index non-list type: " + list_v->toString());
+                getArrayEntry();
+                break;
+            }
+            if (!position->isInteger())
                 throw GssRuntimeException("Tried to index with non-integer type: " + position->toString());
-            GssVariant* list_ptr = memory->getListEntry(list_v->data.i, position->data.i);
+            GssVariant* list_ptr = memory->getListEntry(list_v->getReference(), position->getInteger());
             *list_v = *list_ptr;
             memory->popStack();
         }
@@ -193,11 +870,16 @@ void GssEngine::step()
             GssVariant* var = memory->getStack(-1);
             GssVariant* position = memory->getStack(-2);
             GssVariant* list_v = memory->getStack(-3);
-            if (list_v->type != GssVariant::Type::list)
-                throw GssRuntimeException("Tried to index non-list type: " + list_v->toString());
-            if (position->type != GssVariant::Type::integer)
+            if (!list_v->is(GssVariant::Type::list))
+            {
+                if (!list_v->is(GssVariant::Type::array))
+                    throw GssRuntimeException("Tried to index non-list type: " + list_v->toString());
+                setArrayEntry();
+                break;
+            }
+            if (!position->isInteger())
                 throw GssRuntimeException("Tried to index with non-integer type: " + position->toString());
-            GssVariant* list_ptr = memory->getListEntry(list_v->data.i, position->data.i);
+            GssVariant* list_ptr = memory->getListEntry(list_v->getReference(), position->getInteger());
             *list_ptr = *var;
             memory->popStack();
             memory->popStack();
@@ -208,254 +890,630 @@ void GssEngine::step()
         {
             GssVariant var = *memory->getStack(-1);
             memory->popStack();
-            if (memory->getStack(-1)->type != GssVariant::Type::list)
+            if (!memory->getStack(-1)->is(GssVariant::Type::list))
                 throw GssRuntimeException("Tried to append to non-list data.");
             *memory->appendListOnStack() = var;
         }
         break;
     case GssInstruction::Type::get_from_table_by_string_table:
+        getMember(instruction.data.i);
+        break;
     case GssInstruction::Type::assign_to_table_by_string_table:
-        throw GssRuntimeException("Unknown instruction: " + instruction.toString());
+        setMember(instruction.data.i);
+        memory->popStack();
+        break;
+    case GssInstruction::Type::add_to_dictionary:
+        setMember(instruction.data.i);
+        break;
+    case GssInstruction::Type::get_member_x:
+        {
+            GssVariant* v = memory->getStack(-1);
+            if (v->isVec2())
+                v->setDouble(memory->getVec2(v->getReference())->x);
+            else
+                getMember(instruction.data.i);
+        }
+        break;
+    case GssInstruction::Type::get_member_y:
+        {
+            GssVariant* v = memory->getStack(-1);
+            if (v->isVec2())
+                v->setDouble(memory->getVec2(v->getReference())->y);
+            else
+                getMember(instruction.data.i);
+        }
+        break;
+    case GssInstruction::Type::make_vec2:
+        {
+            GssVariant* x = memory->getStack(-2);
+            GssVariant* y = memory->getStack(-1);
+            if (!GssVariant::bothNumbers(*x, *y))
+                throw GssRuntimeException("Tried to create vec2 from non-numbers: " + x->toString() + " " + y->toString());
+            unsigned int vec2_position = memory->createVec2(x->toDouble(), y->toDouble());
+            memory->popStack();
+            memory->getStack(-1)->setReference(GssVariant::Type::vec2, vec2_position);
+        }
         break;
 
     case GssInstruction::Type::call_function:
+    case GssInstruction::Type::tail_call_function:
         {
             GssVariant* func_info = memory->getStack(-instruction.data.i - 1);
-            if (func_info->type == GssVariant::Type::script_function)
+            if (func_info->is(GssVariant::Type::script_function))
             {
-                unsigned int new_instruction_pointer = func_info->data.i;
-                func_info->type = GssVariant::Type::function_return_data;
-                if (instruction_pointer + 1 >= std::numeric_limits<uint16_t>::max())
-                    throw GssRuntimeException("Stack overflow (instruction out of range on call)");
-                if (locals_stack_position >= std::numeric_limits<uint16_t>::max())
-                    throw GssRuntimeException("Stack overflow (local position out of range on call)");
-                func_info->data.s[0] = instruction_pointer + 1;
-                func_info->data.s[1] = locals_stack_position;
-                locals_stack_position = memory->getStackSize() - instruction.data.i;
-                instruction_pointer = new_instruction_pointer;
+                if (instruction.type == GssInstruction::Type::tail_call_function)
+                    tailCallScriptFunction(func_info->getReference(), instruction.data.i);
+                else
+                    callScriptFunction(func_info->getReference(), instruction.data.i);
                 return;
-            }else if (func_info->type == GssVariant::Type::native_function)
+            }else if (func_info->is(GssVariant::Type::native_function))
             {
+                tick();
                 GssNativeFunctionCallData function_call_data(memory->getStackSize() - instruction.data.i, instruction.data.i, memory);
-                func_info->type = GssVariant::Type::none; //The func_info stack location will be used to store the return value. So set this to None in case the native function does not set a return value.
-                native_functions[func_info->data.i].function(function_call_data);
+                unsigned int native_function_index = func_info->getReference();
+                func_info->setNone(); //The func_info stack location will be used to store the return value. So set this to None in case the native function does not set a return value.
+                native_functions[native_function_index].function(function_call_data);
                 memory->setStackSize(memory->getStackSize() - instruction.data.i);
             }else{
                 throw GssRuntimeException("Tried to call function on non-function variable: " + func_info->toString());
             }
         }
         break;
+    case GssInstruction::Type::call_script:
+        callScriptFunction(instruction.data.i, program->functions[instruction.data.i].parameter_count);
+        return;
+    case GssInstruction::Type::tail_call_script:
+        tailCallScriptFunction(instruction.data.i, program->functions[instruction.data.i].parameter_count);
+        return;
+    case GssInstruction::Type::compile_function:
+        {
+            unsigned int function_index = instruction.data.i;
+            try
+            {
+                compileLazyFunction(program, function_index);
+            }catch(GssTokenizerException e)
+            {
+                throw GssRuntimeException(e.message);
+            }catch(GssCompilerException e)
+            {
+                throw GssRuntimeException(e.message);
+            }
+            jit_entry_points.resize(program->code.size(), nullptr);
+            inline_caches.resize(program->code.size(), {GssShapeTable::no_shape, GssShapeTable::no_slot, GssShapeTable::no_shape});
+            //A JIT compile on the first call only saw the stub, count the calls again.
+            function_call_counts[function_index] = 0;
+            //The call frame is already there, continue in the body. The body is appended, which ends the inner loop of run().
+            instruction_pointer = program->functions[function_index].address;
+            memory->reserveScratch(program->functions[function_index].scratch_size);
+        }
+        return;
+    case GssInstruction::Type::end_program:
+        instruction_pointer = program->code.size();
+        return;
     case GssInstruction::Type::ensure_locals:
         while(memory->getStackSize() < locals_stack_position + instruction.data.i)
-            memory->appendStack()->type = GssVariant::Type::none;
+            memory->appendStack()->setNone();
         break;
     case GssInstruction::Type::return_from_function:
         {
-            if (locals_stack_position == 0)
+            if (call_stack.empty())
                 throw GssRuntimeException("Return while no longer in a function.");
+            GssCallFrame& frame = call_stack.back();
             GssVariant* return_value = memory->getStack(-1);
-            GssVariant* return_info = memory->getStack(locals_stack_position - 1);
+            GssVariant* return_target = memory->getStack(frame.locals_stack_position - 1);
             
-            memory->setStackSize(locals_stack_position);
-            
-            instruction_pointer = return_info->data.s[0];
-            locals_stack_position = return_info->data.s[1];
+            memory->setStackSize(frame.locals_stack_position);
             //The [return_value] variable is now outside of normal stack range due to the setStackSize, but no GC can be triggered yet at this point, so this is safe.
-            *return_info = *return_value;
+            *return_target = *return_value;
+            memory->releaseScratch(frame.scratch_position);
+            
+            instruction_pointer = frame.return_instruction_pointer;
+            call_stack.pop_back();
+            locals_stack_position = call_stack.empty() ? 0 : call_stack.back().locals_stack_position;
         }
         return;
 
     case GssInstruction::Type::boolean_not:
         {
             GssVariant* v0 = memory->getStack(-1);
-            if (v0->isZero())
-            {
-                v0->data.i = 1;
-                v0->type = GssVariant::Type::integer;
-            }else{
-                v0->data.i = 0;
-                v0->type = GssVariant::Type::integer;
-            }
+            v0->setInteger(v0->isZero());
         }
         break;
     case GssInstruction::Type::binary_not:
-        throw GssRuntimeException("Unknown instruction: " + instruction.toString());
+        {
+            GssVariant* v = memory->getStack(-1);
+            if (!v->isInteger())
+                throw GssRuntimeException("Tried to binary not non-integer type: " + v->toString());
+            v->setInteger(~v->getInteger());
+        }
         break;
     case GssInstruction::Type::negative:
         {
             GssVariant* v = memory->getStack(-1);
-            if (v->type == GssVariant::Type::integer)
-                v->data.i = -v->data.i;
-            else if (v->type == GssVariant::Type::float_value)
-                v->data.f = -v->data.f;
+            if (v->isInteger())
+                v->setInteger(-v->getInteger());
+            else if (v->isDouble())
+                v->setDouble(-v->getDouble());
+            else if (v->isVec2())
+            {
+                const GssVec2* vec2 = memory->getVec2(v->getReference());
+                GssVariant result = createVec2(-vec2->x, -vec2->y);
+                //createVec2 can GC, so take the stack entry again.
+                *memory->getStack(-1) = result;
+            }
             else
                 throw GssRuntimeException("Tried to negate non-number type: " + v->toString());
         }
         break;
 
     case GssInstruction::Type::boolean_or:
+        stackOperation<GssInstruction::Type::boolean_or>();
+        break;
     case GssInstruction::Type::boolean_and:
+        stackOperation<GssInstruction::Type::boolean_and>();
+        break;
     case GssInstruction::Type::binary_or:
+        stackOperation<GssInstruction::Type::binary_or>();
+        break;
     case GssInstruction::Type::binary_not_2:
+        stackOperation<GssInstruction::Type::binary_not_2>();
+        break;
     case GssInstruction::Type::binary_and:
+        stackOperation<GssInstruction::Type::binary_and>();
+        break;
     case GssInstruction::Type::boolean_equal:
+        stackOperation<GssInstruction::Type::boolean_equal>();
+        break;
     case GssInstruction::Type::boolean_not_equal:
-        throw GssRuntimeException("Unknown instruction: " + instruction.toString());
+        stackOperation<GssInstruction::Type::boolean_not_equal>();
         break;
     case GssInstruction::Type::boolean_less:
-        {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.i = v0->toFloat() < v1->toFloat();
-                v0->type = GssVariant::Type::integer;
-            }else{
-                throw GssRuntimeException("Bad operation '<' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
-        }
+        stackOperation<GssInstruction::Type::boolean_less>();
         break;
     case GssInstruction::Type::boolean_less_equal:
-        {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.i = v0->toFloat() <= v1->toFloat();
-                v0->type = GssVariant::Type::integer;
-            }else{
-                throw GssRuntimeException("Bad operation '<' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
-        }
+        stackOperation<GssInstruction::Type::boolean_less_equal>();
         break;
     case GssInstruction::Type::boolean_greater:
-        {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.i = v0->toFloat() > v1->toFloat();
-                v0->type = GssVariant::Type::integer;
-            }else{
-                throw GssRuntimeException("Bad operation '<' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
-        }
+        stackOperation<GssInstruction::Type::boolean_greater>();
         break;
     case GssInstruction::Type::boolean_greater_equal:
-        {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.i = v0->toFloat() >= v1->toFloat();
-                v0->type = GssVariant::Type::integer;
-            }else{
-                throw GssRuntimeException("Bad operation '<' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
-        }
+        stackOperation<GssInstruction::Type::boolean_greater_equal>();
+        break;
+    case GssInstruction::Type::add:
+        stackOperation<GssInstruction::Type::add>();
+        break;
+    case GssInstruction::Type::substract:
+        stackOperation<GssInstruction::Type::substract>();
+        break;
+    case GssInstruction::Type::multiply:
+        stackOperation<GssInstruction::Type::multiply>();
+        break;
+    case GssInstruction::Type::division:
+        stackOperation<GssInstruction::Type::division>();
+        break;
+    case GssInstruction::Type::modulo:
+        stackOperation<GssInstruction::Type::modulo>();
         break;
     case GssInstruction::Type::left_shift:
+        stackOperation<GssInstruction::Type::left_shift>();
+        break;
     case GssInstruction::Type::right_shift:
-        throw GssRuntimeException("Unknown instruction: " + instruction.toString());
+        stackOperation<GssInstruction::Type::right_shift>();
         break;
-    case GssInstruction::Type::add:
+
+    case GssInstruction::Type::local_move:
+        *memory->getStack(locals_stack_position + instruction.getRegisterTarget()) = *memory->getStack(locals_stack_position + instruction.getRegisterA());
+        break;
+    case GssInstruction::Type::local_load_int:
         {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->type == GssVariant::Type::integer && v1->type == GssVariant::Type::integer)
-            {
-                v0->data.i = v0->data.i + v1->data.i;
-            }else if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.f = v0->toFloat() + v1->toFloat();
-                v0->type = GssVariant::Type::float_value;
-            }else if (v0->type == GssVariant::Type::string && v1->type == GssVariant::Type::string)
-            {
-                string s0 = memory->getString(v0->data.i);
-                string s1 = memory->getString(v1->data.i);
-                unsigned int new_string_position = memory->createString(s0 + s1);//createString can GC, so we v0 and v1 are invalid at this point.
-                v0 = memory->getStack(-2);
-                v0->data.i = new_string_position;
-            }else{
-                throw GssRuntimeException("Bad operation '+' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
+            memory->getStack(locals_stack_position + instruction.getRegisterTarget())->setInteger(instruction.getRegisterImmediate());
         }
         break;
-    case GssInstruction::Type::substract:
+    case GssInstruction::Type::local_less:
+        registerOperation<GssInstruction::Type::boolean_less>(instruction);
+        break;
+    case GssInstruction::Type::local_less_equal:
+        registerOperation<GssInstruction::Type::boolean_less_equal>(instruction);
+        break;
+    case GssInstruction::Type::local_greater:
+        registerOperation<GssInstruction::Type::boolean_greater>(instruction);
+        break;
+    case GssInstruction::Type::local_greater_equal:
+        registerOperation<GssInstruction::Type::boolean_greater_equal>(instruction);
+        break;
+    case GssInstruction::Type::local_add:
+        registerOperation<GssInstruction::Type::add>(instruction);
+        break;
+    case GssInstruction::Type::local_substract:
+        registerOperation<GssInstruction::Type::substract>(instruction);
+        break;
+    case GssInstruction::Type::local_multiply:
+        registerOperation<GssInstruction::Type::multiply>(instruction);
+        break;
+    case GssInstruction::Type::local_division:
+        registerOperation<GssInstruction::Type::division>(instruction);
+        break;
+    case GssInstruction::Type::local_modulo:
+        registerOperation<GssInstruction::Type::modulo>(instruction);
+        break;
+    default:
+        throw GssRuntimeException("Unknown instruction: " + instruction.toString());
+    }
+    instruction_pointer++;
+}
+
+void GssEngine::callScriptFunction(unsigned int function_index, unsigned int argument_count)
+{
+    tick();
+    //The stack entry below the arguments holds the function variant or a placeholder, it will receive the return value.
+    memory->getStack(-int(argument_count) - 1)->setNone();
+    locals_stack_position = memory->getStackSize() - argument_count;
+    call_stack.push_back({instruction_pointer + 1, locals_stack_position, function_index, memory->getScratchPoint()});
+    instruction_pointer = program->functions[function_index].address;
+    memory->reserveScratch(program->functions[function_index].scratch_size);
+    countFunctionCall(function_index);
+}
+
+/*
+    Call for "return f(x)": the arguments replace the locals of the current function, and its call frame is reused,
+    so the return of the called function goes straight to the caller of the current one.
+    Recursion in tail position then runs in constant stack and call stack space.
+*/
+void GssEngine::tailCallScriptFunction(unsigned int function_index, unsigned int argument_count)
+{
+    tick();
+    unsigned int argument_position = memory->getStackSize() - argument_count;
+    for(unsigned int index=0; index<argument_count; index++)
+        *memory->getStack(locals_stack_position + index) = *memory->getStack(argument_position + index);
+    memory->setStackSize(locals_stack_position + argument_count);
+    call_stack.back().function_index = function_index;
+    instruction_pointer = program->functions[function_index].address;
+    //The compiler never passes scratch lists of the current call to a tail call, so its room can be reused.
+    memory->releaseScratch(call_stack.back().scratch_position);
+    memory->reserveScratch(program->functions[function_index].scratch_size);
+    countFunctionCall(function_index);
+}
+
+void GssEngine::countFunctionCall(unsigned int function_index)
+{
+    if (jit_enabled && function_call_counts[function_index] < jit_call_threshold)
+    {
+        function_call_counts[function_index]++;
+        if (function_call_counts[function_index] == jit_call_threshold)
         {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->type == GssVariant::Type::integer && v1->type == GssVariant::Type::integer)
-            {
-                v0->data.i = v0->data.i - v1->data.i;
-            }else if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.f = v0->toFloat() - v1->toFloat();
-                v0->type = GssVariant::Type::float_value;
-            }else{
-                throw GssRuntimeException("Bad operation '-' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
+            const GssFunctionInfo& info = program->functions[function_index];
+            if (!jit)
+                jit = new GssJit();
+            if (!jit->compile(program->code, program->number_table, info.address, info.end_address, jit_entry_points))
+                LOG(WARNING) << "Failed to compile " << info.name << "() to native code";
         }
-        break;
-    case GssInstruction::Type::multiply:
+    }
+}
+
+//Stack: array, index. Replaced by the element.
+void GssEngine::getArrayEntry()
+{
+    GssVariant* position = memory->getStack(-1);
+    GssVariant* array_v = memory->getStack(-2);
+    GssArray* array = memory->getArray(array_v->getReference());
+    int64_t index = getArrayIndex(*position, array->length);
+    if (array->element_type == GssArray::ElementType::float32)
+        array_v->setDouble(array->getFloats()[index]);
+    else
+        array_v->setInteger(array->getInts()[index]);
+    memory->popStack();
+}
+
+//Stack: array, index, value. All three are popped.
+void GssEngine::setArrayEntry()
+{
+    GssVariant* value = memory->getStack(-1);
+    GssVariant* position = memory->getStack(-2);
+    GssArray* array = memory->getArray(memory->getStack(-3)->getReference());
+    int64_t index = getArrayIndex(*position, array->length);
+    if (!value->isNumber())
+        throw GssRuntimeException("Tried to store non-number in array: " + value->toString());
+    if (array->element_type == GssArray::ElementType::float32)
+        array->getFloats()[index] = value->toDouble();
+    else
+        array->getInts()[index] = GssArray::toInt32(value->toDouble());
+    memory->setStackSize(memory->getStackSize() - 3);
+}
+
+//Negative indices count from the end, like for lists.
+int64_t GssEngine::getArrayIndex(const GssVariant& position, uint32_t length)
+{
+    if (!position.isInteger())
+        throw GssRuntimeException("Tried to index with non-integer type: " + position.toString());
+    int64_t index = position.getInteger();
+    if (index < 0)
+        index += length;
+    if (index < 0 || index >= length)
+        throw GssRuntimeException("Index out of range: " + string(int(position.getInteger())));
+    return index;
+}
+
+void GssEngine::getMember(unsigned int key)
+{
+    GssVariant* v = memory->getStack(-1);
+    if (!v->is(GssVariant::Type::dictionary))
+        throw GssRuntimeException("Tried to get member '" + program->string_table[key] + "' of non-dictionary type: " + v->toString());
+    GssDictionary* dictionary = memory->getDictionary(v->getReference());
+    GssInlineCache& cache = inline_caches[instruction_pointer];
+    if (cache.shape != dictionary->shape)
+    {
+        cache.shape = dictionary->shape;
+        cache.slot = memory->getShapes().findSlot(dictionary->shape, key);
+    }
+    //Missing members read as none.
+    if (cache.slot == GssShapeTable::no_slot)
+        v->setNone();
+    else
+        *v = *memory->getDictionaryEntry(v->getReference(), cache.slot);
+}
+
+void GssEngine::setMember(unsigned int key)
+{
+    //Stack: dictionary, value. Pops the value and leaves the dictionary.
+    GssVariant* v = memory->getStack(-2);
+    if (!v->is(GssVariant::Type::dictionary))
+        throw GssRuntimeException("Tried to set member '" + program->string_table[key] + "' of non-dictionary type: " + v->toString());
+    GssDictionary* dictionary = memory->getDictionary(v->getReference());
+    GssInlineCache& cache = inline_caches[instruction_pointer];
+    if (cache.shape != dictionary->shape)
+    {
+        GssShapeTable& shapes = memory->getShapes();
+        cache.shape = dictionary->shape;
+        cache.slot = shapes.findSlot(dictionary->shape, key);
+        cache.new_shape = dictionary->shape;
+        if (cache.slot == GssShapeTable::no_slot)
         {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->type == GssVariant::Type::integer && v1->type == GssVariant::Type::integer)
-            {
-                v0->data.i = v0->data.i * v1->data.i;
-            }else if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.f = v0->toFloat() * v1->toFloat();
-                v0->type = GssVariant::Type::float_value;
-            }else{
-                throw GssRuntimeException("Bad operation '-' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
+            cache.new_shape = shapes.addKey(dictionary->shape, key);
+            cache.slot = shapes.getSlotCount(cache.new_shape) - 1;
         }
-        break;
+    }
+    if (cache.new_shape != cache.shape)
+        memory->addDictionarySlotOnStack(-2, cache.new_shape);
+    *memory->getDictionaryEntry(memory->getStack(-2)->getReference(), cache.slot) = *memory->getStack(-1);
+    memory->popStack();
+}
+
+void GssEngine::resetInlineCaches()
+{
+    inline_caches.assign(program->code.size(), {GssShapeTable::no_shape, GssShapeTable::no_slot, GssShapeTable::no_shape});
+}
+
+unsigned int GssEngine::runNativeCode(const void* entry_point)
+{
+    //Native code does not allocate, so the stack stays in place while it runs.
+    GssList* stack = memory->getStackList();
+    GssVariant* stack_start = memory->getStack(0);
+    GssJitContext context;
+    context.locals = stack_start + locals_stack_position;
+    context.stack_top = stack_start + stack->current_length;
+    context.stack_end = stack_start + stack->reserved_length;
+    context.memory = (uint8_t*)memory->getMemoryBase();
+    context.globals = memory->getGlobals();
+    context.tick_budget = tick_budget;
+    unsigned int next_instruction = jit->execute(entry_point, context);
+    stack->current_length = context.stack_top - stack_start;
+    tick_budget = context.tick_budget;
+    return next_instruction;
+}
+
+string GssEngine::getStackTrace()
+{
+    static constexpr int max_frames = 16;
+    string result;
+    unsigned int ip = instruction_pointer;
+    for(int index=call_stack.size() - 1; index>=0; index--)
+    {
+        if (int(call_stack.size()) - index > max_frames)
+        {
+            result += "\n  ... " + string(index + 1) + " more calls";
+            ip = call_stack[0].return_instruction_pointer - 1;
+            break;
+        }
+        result += "\n  in " + program->functions[call_stack[index].function_index].name + "() at line " + string(program->debug_info.getLine(ip));
+        ip = call_stack[index].return_instruction_pointer - 1;
+    }
+    result += "\n  in global code at line " + string(program->debug_info.getLine(ip));
+    return result;
+}
+
+bool GssEngine::isEqual(const GssVariant& v0, const GssVariant& v1)
+{
+    //Numbers compare by value, so 1 == 1.0. Strings and vec2s compare by contents, everything else by identity.
+    if (GssVariant::bothIntegers(v0, v1))
+        return v0.getInteger() == v1.getInteger();
+    if (GssVariant::bothNumbers(v0, v1))
+        return v0.toDouble() == v1.toDouble();
+    if (v0.is(GssVariant::Type::string) && v1.is(GssVariant::Type::string))
+        return v0.getReference() == v1.getReference() || memory->getString(v0.getReference()) == memory->getString(v1.getReference());
+    if (v0.isVec2() && v1.isVec2())
+    {
+        const GssVec2* a = memory->getVec2(v0.getReference());
+        const GssVec2* b = memory->getVec2(v1.getReference());
+        return a->x == b->x && a->y == b->y;
+    }
+    return v0.bits == v1.bits;
+}
+
+GssVariant GssEngine::createVec2(double x, double y)
+{
+    //The components are passed by value, as the allocation can run the GC and move the operands.
+    GssVariant result;
+    result.setReference(GssVariant::Type::vec2, memory->createVec2(x, y));
+    return result;
+}
+
+template<GssInstruction::Type operation> void GssEngine::stackOperation()
+{
+    GssVariant result = binaryOperation<operation>(*memory->getStack(-2), *memory->getStack(-1));
+    memory->popStack();
+    *memory->getStack(-1) = result;
+}
+
+template<GssInstruction::Type operation> void GssEngine::registerOperation(const GssInstruction& instruction)
+{
+    GssVariant* v0 = memory->getStack(locals_stack_position + instruction.getRegisterA());
+    GssVariant* v1 = memory->getStack(locals_stack_position + instruction.getRegisterB());
+    GssVariant result = binaryOperation<operation>(*v0, *v1);
+    //Reference the target after the operation, as string concatenation can run the GC.
+    *memory->getStack(locals_stack_position + instruction.getRegisterTarget()) = result;
+}
+
+template<GssInstruction::Type operation> GssVariant GssEngine::binaryOperation(GssVariant& v0, GssVariant& v1)
+{
+    GssVariant result;
+    switch(operation)
+    {
+    //Not generated by the compiler, which turns && and || into jumps, but kept for completeness: both sides are evaluated.
+    case GssInstruction::Type::boolean_or:
+        result.setInteger(!v0.isZero() || !v1.isZero());
+        return result;
+    case GssInstruction::Type::boolean_and:
+        result.setInteger(!v0.isZero() && !v1.isZero());
+        return result;
+    case GssInstruction::Type::boolean_equal:
+        result.setInteger(isEqual(v0, v1));
+        return result;
+    case GssInstruction::Type::boolean_not_equal:
+        result.setInteger(!isEqual(v0, v1));
+        return result;
+    case GssInstruction::Type::binary_or:
+        if (!GssVariant::bothIntegers(v0, v1))
+            throw GssRuntimeException("Bad operation '|' on types: " + v0.toString() + " " + v1.toString());
+        result.setInteger(v0.getInteger() | v1.getInteger());
+        return result;
+    case GssInstruction::Type::binary_not_2:
+        if (!GssVariant::bothIntegers(v0, v1))
+            throw GssRuntimeException("Bad operation '^' on types: " + v0.toString() + " " + v1.toString());
+        result.setInteger(v0.getInteger() ^ v1.getInteger());
+        return result;
+    case GssInstruction::Type::binary_and:
+        if (!GssVariant::bothIntegers(v0, v1))
+            throw GssRuntimeException("Bad operation '&' on types: " + v0.toString() + " " + v1.toString());
+        result.setInteger(v0.getInteger() & v1.getInteger());
+        return result;
+    //The shift amount is taken modulo 64, like x86 does.
+    case GssInstruction::Type::left_shift:
+        if (!GssVariant::bothIntegers(v0, v1))
+            throw GssRuntimeException("Bad operation '<<' on types: " + v0.toString() + " " + v1.toString());
+        result.setInteger(uint64_t(v0.getInteger()) << (v1.getInteger() & 63));
+        return result;
+    case GssInstruction::Type::right_shift:
+        if (!GssVariant::bothIntegers(v0, v1))
+            throw GssRuntimeException("Bad operation '>>' on types: " + v0.toString() + " " + v1.toString());
+        result.setInteger(v0.getInteger() >> (v1.getInteger() & 63));
+        return result;
+    case GssInstruction::Type::boolean_less:
+        if (GssVariant::bothIntegers(v0, v1))
+            result.setInteger(v0.getInteger() < v1.getInteger());
+        else if (GssVariant::bothNumbers(v0, v1))
+            result.setInteger(v0.toDouble() < v1.toDouble());
+        else
+            throw GssRuntimeException("Bad operation '<' on types: " + v0.toString() + " " + v1.toString());
+        return result;
+    case GssInstruction::Type::boolean_less_equal:
+        if (GssVariant::bothIntegers(v0, v1))
+            result.setInteger(v0.getInteger() <= v1.getInteger());
+        else if (GssVariant::bothNumbers(v0, v1))
+            result.setInteger(v0.toDouble() <= v1.toDouble());
+        else
+            throw GssRuntimeException("Bad operation '<=' on types: " + v0.toString() + " " + v1.toString());
+        return result;
+    case GssInstruction::Type::boolean_greater:
+        if (GssVariant::bothIntegers(v0, v1))
+            result.setInteger(v0.getInteger() > v1.getInteger());
+        else if (GssVariant::bothNumbers(v0, v1))
+            result.setInteger(v0.toDouble() > v1.toDouble());
+        else
+            throw GssRuntimeException("Bad operation '>' on types: " + v0.toString() + " " + v1.toString());
+        return result;
+    case GssInstruction::Type::boolean_greater_equal:
+        if (GssVariant::bothIntegers(v0, v1))
+            result.setInteger(v0.getInteger() >= v1.getInteger());
+        else if (GssVariant::bothNumbers(v0, v1))
+            result.setInteger(v0.toDouble() >= v1.toDouble());
+        else
+            throw GssRuntimeException("Bad operation '>=' on types: " + v0.toString() + " " + v1.toString());
+        return result;
+    case GssInstruction::Type::add:
+        //Integer math is done unsigned, setInteger wraps the result around at 48 bits.
+        if (GssVariant::bothIntegers(v0, v1))
+        {
+            result.setInteger(uint64_t(v0.getInteger()) + uint64_t(v1.getInteger()));
+        }else if (GssVariant::bothNumbers(v0, v1))
+        {
+            result.setDouble(v0.toDouble() + v1.toDouble());
+        }else if (v0.is(GssVariant::Type::string) && v1.is(GssVariant::Type::string))
+        {
+            //createString can GC, so v0 and v1 are no longer valid references into memory after this.
+            unsigned int new_string_position = memory->createString(memory->getString(v0.getReference()) + memory->getString(v1.getReference()));
+            result.setReference(GssVariant::Type::string, new_string_position);
+        }else if (v0.isVec2() && v1.isVec2())
+        {
+            const GssVec2* a = memory->getVec2(v0.getReference());
+            const GssVec2* b = memory->getVec2(v1.getReference());
+            result = createVec2(a->x + b->x, a->y + b->y);
+        }else{
+            throw GssRuntimeException("Bad operation '+' on types: " + v0.toString() + " " + v1.toString());
+        }
+        return result;
+    case GssInstruction::Type::substract:
+        if (GssVariant::bothIntegers(v0, v1))
+            result.setInteger(uint64_t(v0.getInteger()) - uint64_t(v1.getInteger()));
+        else if (GssVariant::bothNumbers(v0, v1))
+            result.setDouble(v0.toDouble() - v1.toDouble());
+        else if (v0.isVec2() && v1.isVec2())
+            result = createVec2(memory->getVec2(v0.getReference())->x - memory->getVec2(v1.getReference())->x, memory->getVec2(v0.getReference())->y - memory->getVec2(v1.getReference())->y);
+        else
+            throw GssRuntimeException("Bad operation '-' on types: " + v0.toString() + " " + v1.toString());
+        return result;
+    case GssInstruction::Type::multiply:
+        if (GssVariant::bothIntegers(v0, v1))
+            result.setInteger(uint64_t(v0.getInteger()) * uint64_t(v1.getInteger()));
+        else if (GssVariant::bothNumbers(v0, v1))
+            result.setDouble(v0.toDouble() * v1.toDouble());
+        else if (v0.isVec2() && v1.isNumber())
+            result = createVec2(memory->getVec2(v0.getReference())->x * v1.toDouble(), memory->getVec2(v0.getReference())->y * v1.toDouble());
+        else if (v0.isNumber() && v1.isVec2())
+            result = createVec2(v0.toDouble() * memory->getVec2(v1.getReference())->x, v0.toDouble() * memory->getVec2(v1.getReference())->y);
+        else
+            throw GssRuntimeException("Bad operation '*' on types: " + v0.toString() + " " + v1.toString());
+        return result;
     case GssInstruction::Type::division:
+        if (GssVariant::bothIntegers(v0, v1))
         {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->type == GssVariant::Type::integer && v1->type == GssVariant::Type::integer)
-            {
-                v0->data.i = v0->data.i / v1->data.i;
-            }else if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.f = v0->toFloat() / v1->toFloat();
-                v0->type = GssVariant::Type::float_value;
-            }else{
-                throw GssRuntimeException("Bad operation '-' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
+            if (v1.getInteger() == 0)
+                throw GssRuntimeException("Integer division by zero");
+            result.setInteger(v0.getInteger() / v1.getInteger());
+        }else if (GssVariant::bothNumbers(v0, v1))
+        {
+            result.setDouble(v0.toDouble() / v1.toDouble());
+        }else if (v0.isVec2() && v1.isNumber())
+        {
+            const GssVec2* a = memory->getVec2(v0.getReference());
+            result = createVec2(a->x / v1.toDouble(), a->y / v1.toDouble());
+        }else{
+            throw GssRuntimeException("Bad operation '/' on types: " + v0.toString() + " " + v1.toString());
         }
-        break;
+        return result;
     case GssInstruction::Type::modulo:
+        if (GssVariant::bothIntegers(v0, v1))
         {
-            GssVariant* v0 = memory->getStack(-2);
-            GssVariant* v1 = memory->getStack(-1);
-            if (v0->type == GssVariant::Type::integer && v1->type == GssVariant::Type::integer)
-            {
-                v0->data.i = v0->data.i % v1->data.i;
-            }else if (v0->canBeFloat() && v1->canBeFloat())
-            {
-                v0->data.f = fmodf(v0->toFloat(), v1->toFloat());
-                v0->type = GssVariant::Type::float_value;
-            }else{
-                throw GssRuntimeException("Bad operation '-' on types: " + v0->toString() + " " + v1->toString());
-            }
-            memory->popStack();
+            if (v1.getInteger() == 0)
+                throw GssRuntimeException("Integer modulo by zero");
+            result.setInteger(v0.getInteger() % v1.getInteger());
+        }else if (GssVariant::bothNumbers(v0, v1))
+        {
+            result.setDouble(fmod(v0.toDouble(), v1.toDouble()));
+        }else{
+            throw GssRuntimeException("Bad operation '%' on types: " + v0.toString() + " " + v1.toString());
         }
-        break;
+        return result;
     default:
-        throw GssRuntimeException("Unknown instruction: " + instruction.toString());
+        throw GssRuntimeException("Unknown binary operation: " + GssInstruction(operation).toString());
     }
-    instruction_pointer++;
 }
@@ -1,28 +1,253 @@
 #ifndef GSS_H
 #define GSS_H
 
+#include <chrono>
+#include <memory>
+
 #include "stringImproved.h"
 #include "gss_instructions.h"
+#include "gss_debug_info.h"
 #include "gss_memory.h"
 #include "gss_native_function_call_data.h"
 
+class GssJit;
+class GssProfiler;
+class GssLazySource;
+class GssModuleCache;
+
+/*
+    Compiled script. Engines forked from each other, and engines that load the same program, share it unchanged.
+    Compiling a lazy function appends the body, in place when the engine is the only user of the program, else to its own copy.
+*/
+class GssProgram
+{
+public:
+    GssCode code; //The instructions, packed. Only kept in this form, decoded again where the fields are needed.
+    std::vector<string> string_table;
+    std::vector<double> number_table;
+    std::vector<GssFunctionInfo> functions;
+    std::vector<string> global_names;
+    unsigned int native_function_count; //The first globals, the native functions of the engine that compiled the program.
+    GssDebugInfo debug_info;
+    std::shared_ptr<GssLazySource> lazy_source; //Source of the function bodies that are compiled on their first call, nullptr without lazy compile.
+    std::vector<unsigned int> lazy_compiled_functions; //Functions compiled on their first call, in the order they were compiled.
+
+    GssProgram() : native_function_count(0) {}
+};
+
+class GssCallFrame
+{
+public:
+    unsigned int return_instruction_pointer;
+    unsigned int locals_stack_position; //Start of the locals of this call on the stack, the return value is stored just below this.
+    unsigned int function_index;
+    unsigned int scratch_position; //Scratch point of the memory before the call, restored on return.
+};
+
+/*
+    Per instruction cache for member access on dictionaries: the shape of the last dictionary the instruction saw,
+    and the slot of the member in dictionaries of that shape. As long as the same shape comes by, the member is
+    found without looking at the shape table.
+*/
+class GssInlineCache
+{
+public:
+    uint32_t shape;
+    uint32_t slot;
+    uint32_t new_shape; //Shape after an assignment, differs from [shape] when the assignment adds the member.
+};
+
+/*
+    Resource limits of an engine, to run scripts that cannot be trusted to end or to stay small. 0 means no limit.
+    A script that goes over a limit is stopped with an error, like any runtime error.
+    Ticks are counted on backward jumps and calls, in interpreted and native code alike, so they bound the work of a script
+    without a counter on every instruction. The clock is only read every few thousand ticks.
+*/
+class GssLimits
+{
+public:
+    uint64_t max_ticks;         //Over the lifetime of the loaded program.
+    unsigned int max_heap_size; //Bytes in use by the heap and the scratch room after a GC.
+    double max_run_time;        //Seconds of a single run() call.
+
+    GssLimits() : max_ticks(0), max_heap_size(0), max_run_time(0.0) {}
+};
+
+enum class GssLimit
+{
+    none,
+    ticks,
+    heap_size,
+    run_time,
+};
+
+/*
+    Resources a script used since load(), to find the scripts that cost the most.
+*/
+class GssUsage
+{
+public:
+    uint64_t ticks;                 //Backward jumps and calls, the measure of GssLimits::max_ticks.
+    uint64_t instructions;          //Interpreted instructions, without the ones that ran as native code.
+    double run_time;                //Seconds spent in run(), including native code, native functions and the GC.
+    unsigned int run_count;
+    GssLimit exceeded;              //The limit that stopped the script.
+    GssMemoryStatistics memory;
+
+    GssUsage() : ticks(0), instructions(0), run_time(0.0), run_count(0), exceeded(GssLimit::none) {}
+};
+
+/*
+    Result of compiling one script with GssEngine::compileBatch().
+*/
+class GssCompileResult
+{
+public:
+    std::shared_ptr<const GssProgram> program; //nullptr when the script has errors.
+    string error;
+    double compile_time; //Seconds, on the thread that compiled the script.
+
+    GssCompileResult() : compile_time(0.0) {}
+};
+
 class GssEngine : sf::NonCopyable
 {
 public:
+    GssEngine();
+    ~GssEngine();
+
+    //Compile the code and run it till the end, errors are logged.
     void compile(string code);
+    //Compile the code and prepare it for running without running anything. Returns false on compile errors.
+    bool load(string code);
+    //Prepare a program from compileBatch() for running. The program is shared, not copied. Returns false when
+    //this engine does not have the native functions the program was compiled with.
+    bool load(std::shared_ptr<const GssProgram> program);
+    //Compile many scripts at once, spread over [thread_count] threads (0 for one per core), with the native functions,
+    //backend, lazy compile and module settings of this engine. The results are in the order of [sources], errors are logged.
+    //Does not change the state of this engine, and the programs can be loaded into any engine with the same native functions.
+    std::vector<GssCompileResult> compileBatch(const std::vector<string>& sources, unsigned int thread_count = 0);
+    //Run the loaded program. When max_instructions is not zero, execution pauses after that many interpreted instructions and continues on the next run() call.
+    //Returns true while the program has not finished.
+    bool run(uint64_t max_instructions = 0);
+    bool isRunning();
+    //Why the last run() returned before the end of the program: GssWaitReason::none when it hit the instruction limit,
+    //else the script paused itself with yield, wait(seconds) or wait_event(name). The script continues on the next run() in all cases,
+    //it is up to the caller (for example a GssScheduler) to decide when that is.
+    GssWaitReason getWaitReason() { return wait_reason; }
+    double getWaitTime() { return wait_time; } //Seconds, for GssWaitReason::time.
+    const string& getWaitEvent() { return wait_event; } //Event name, for GssWaitReason::event.
+    //Compile new code for the loaded program, errors are logged and return false while the old code keeps running.
+    //The new code takes over at the start of the first run() call where no script function is active, see isReloadPending(). Globals keep their value when
+    //the new code has a global with the same name, and the global code of the new program runs from the start, skipping the
+    //initializers of top level variables that kept their value. Function values inside lists and dictionaries are not remapped.
+    bool reload(string code);
+    //True while reloaded code waits for the script functions to return. A script that keeps yielding inside a function never gets there,
+    //load() the new code instead to start over.
+    bool isReloadPending() { return reloaded_program != nullptr; }
+
+    //Store the complete state of the loaded program (heap, stack, globals and call frames) in a binary blob.
+    //A snapshot can only be restored into an engine that has loaded the same program.
+    std::vector<uint8_t> snapshot();
+    bool restore(const std::vector<uint8_t>& data);
+
+    //Create a new engine that continues from the current state of this engine, for example after running the global init code once.
+    //The compiled program is shared, and the heap is shared copy-on-write where the platform supports it, so forking does not copy or re-run anything.
+    //Native functions and settings are taken over from this engine. The caller owns the returned engine.
+    GssEngine* fork();
+
+    //Sample the script call stack into the profiler every [interval] interpreted instructions, nullptr stops profiling.
+    //Native code does not take samples, so the JIT is not used while a profiler is set.
+    void setProfiler(GssProfiler* profiler, unsigned int interval = 1000);
     void addNativeFunction(string name, std::function<void(GssNativeFunctionCallData&)> function);
+    void setRegisterBackend(bool enabled);
+    void setMemorySize(unsigned int size); //Size of the script heap in bytes, used by the next load(). The GC needs room for a copy of the live data.
+    //Compile function bodies on their first call instead of in load(). Compile errors in a body are then runtime errors on the first call.
+    void setLazyCompile(bool enabled);
+    //Compile script functions to native code once they are called [call_threshold] times. Only has effect on platforms supported by GssJit.
+    void setJitEnabled(bool enabled, unsigned int call_threshold = 100);
+    void setLimits(const GssLimits& limits); //Takes effect right away, also for a program that is already loaded.
+    //Modules for `import name` in the scripts this engine compiles. The cache is not owned by the engine, and can be shared by many engines.
+    void setModuleCache(GssModuleCache* cache);
     
     void step();
+    
+    unsigned int getInstructionCount() { return program->code.size(); }
+    unsigned int getFunctionCount() { return program->functions.size(); }
+    unsigned int getCompiledFunctionCount() { return program->lazy_source ? program->lazy_compiled_functions.size() : program->functions.size(); }
+    uint64_t getExecutedInstructionCount() { return executed_instruction_count; }
+    GssMemoryStatistics getMemoryStatistics() { return memory ? memory->getStatistics() : GssMemoryStatistics(); }
+    GssUsage getUsage();
 private:
     GssMemory* memory;
+    unsigned int memory_size;
+    bool register_backend;
+    bool lazy_compile;
+    GssModuleCache* module_cache;
+    uint64_t executed_instruction_count; //Only counts interpreted instructions, not the ones that run as native code.
+
+    GssJit* jit; //Created when the first function is compiled to native code.
+    bool jit_enabled;
+    unsigned int jit_call_threshold;
+    std::vector<unsigned int> function_call_counts;
+    std::vector<const void*> jit_entry_points; //Native code entry per instruction, nullptr when the instruction has to be interpreted.
+    std::vector<GssInlineCache> inline_caches; //Indexed by instruction pointer, only used by member access instructions.
+
+    GssLimits limits;
+    GssUsage usage; //Ticks are only added on checkLimits(), getUsage() adds the ones counted since then.
+    int64_t tick_budget;        //Ticks till the next checkLimits(), counted down by the interpreter and by native code.
+    int64_t tick_budget_start;  //Value [tick_budget] was last set to.
+    std::chrono::steady_clock::time_point run_deadline;
+
+    GssProfiler* profiler;
+    unsigned int profiler_interval;
+    uint64_t next_profiler_sample;
 
     std::vector<GssNativeFunction> native_functions;
 
-    std::vector<GssInstruction> instructions;
-    std::vector<string> string_table;
+    std::shared_ptr<const GssProgram> program;
+    std::shared_ptr<const GssProgram> reloaded_program; //Waiting for a safe point to replace [program].
+    std::vector<bool> kept_globals; //Globals that kept their value over the last reload, indexed by global index.
+    std::shared_ptr<GssMemoryImage> memory_image; //Heap image that forks are created from, dropped as soon as this engine runs again.
     
     unsigned int instruction_pointer;
-    unsigned int locals_stack_position;
+    unsigned int locals_stack_position; //Cached copy of the locals_stack_position of the top call frame, 0 when no function is active.
+    std::vector<GssCallFrame> call_stack;
+
+    GssWaitReason wait_reason;
+    double wait_time;
+    string wait_event;
+    unsigned int resume_instruction_pointer; //Instruction after the suspend, the instruction pointer itself is moved past the end to leave the run() loop.
+    
+    std::shared_ptr<GssProgram> compileProgram(string code, const GssProgram* previous_program);
+    //Throws the compiler and tokenizer exceptions. Only reads the settings of the engine, so it can run on many threads at once.
+    std::shared_ptr<GssProgram> buildProgram(string code, const GssProgram* previous_program, bool log_code);
+    static void compileLazyFunction(std::shared_ptr<const GssProgram>& program, unsigned int function_index);
+    void unload(); //Drops the program and all state of running it, the memory is dropped on the next load.
+    void switchToReloadedProgram();
+    void stopAfterError();
+    bool runProgram(uint64_t max_instructions);
+    void tick() { if (--tick_budget <= 0) checkLimits(); }
+    void checkLimits(); //Throws when the script is over a limit, else sets the next [tick_budget].
+    void resetTickBudget();
+    unsigned int runNativeCode(const void* entry_point);
+    void callScriptFunction(unsigned int function_index, unsigned int argument_count);
+    void tailCallScriptFunction(unsigned int function_index, unsigned int argument_count);
+    void countFunctionCall(unsigned int function_index); //Compiles the function to native code when it gets hot.
+    void getArrayEntry();
+    void setArrayEntry();
+    int64_t getArrayIndex(const GssVariant& position, uint32_t length);
+    void getMember(unsigned int key);
+    void setMember(unsigned int key);
+    void resetInlineCaches();
+    template<GssInstruction::Type operation> void stackOperation();
+    template<GssInstruction::Type operation> void registerOperation(const GssInstruction& instruction);
+    template<GssInstruction::Type operation> GssVariant binaryOperation(GssVariant& v0, GssVariant& v1);
+    bool isEqual(const GssVariant& v0, const GssVariant& v1);
+    GssVariant createVec2(double x, double y);
+    string getStackTrace();
+    void takeProfilerSample();
+    static uint32_t getProgramChecksum(const GssProgram& program);
 };
 
 class GssRuntimeException : public std::exception
@@ -0,0 +1,411 @@
+#include "gss_array.h"
+#include "gss.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+    Kernels on packed values. Each handles 4 elements per step with SSE2 when available,
+    and the remaining elements (or all of them without SSE2) one by one.
+*/
+static double sumFloats(const float* values, unsigned int count)
+{
+    unsigned int index = 0;
+    double result = 0.0;
+#ifdef __SSE2__
+    //Sum as doubles, float sums of long series lose too much precision.
+    __m128d total_low = _mm_setzero_pd();
+    __m128d total_high = _mm_setzero_pd();
+    for(; index + 4 <= count; index += 4)
+    {
+        __m128 v = _mm_loadu_ps(values + index);
+        total_low = _mm_add_pd(total_low, _mm_cvtps_pd(v));
+        total_high = _mm_add_pd(total_high, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(total_low, total_high));
+    result = lanes[0] + lanes[1];
+#endif
+    for(; index < count; index++)
+        result += values[index];
+    return result;
+}
+
+static int64_t sumInts(const int32_t* values, unsigned int count)
+{
+    unsigned int index = 0;
+    int64_t result = 0;
+#ifdef __SSE2__
+    __m128i total = _mm_setzero_si128();
+    for(; index + 4 <= count; index += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + index));
+        //Sign extend to 64 bit lanes, SSE2 has no instruction for that.
+        __m128i sign = _mm_srai_epi32(v, 31);
+        total = _mm_add_epi64(total, _mm_unpacklo_epi32(v, sign));
+        total = _mm_add_epi64(total, _mm_unpackhi_epi32(v, sign));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, total);
+    result = lanes[0] + lanes[1];
+#endif
+    for(; index < count; index++)
+        result += values[index];
+    return result;
+}
+
+//Smallest or largest value. NaNs are skipped, so an array of only NaNs gives an infinity.
+template<bool maximum> static float extremeFloat(const float* values, unsigned int count)
+{
+    unsigned int index = 0;
+    float result = maximum ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::infinity();
+#ifdef __SSE2__
+    __m128 best = _mm_set1_ps(result);
+    for(; index + 4 <= count; index += 4)
+    {
+        //MINPS and MAXPS give the second operand when one of them is NaN, which keeps the NaNs out.
+        __m128 v = _mm_loadu_ps(values + index);
+        best = maximum ? _mm_max_ps(v, best) : _mm_min_ps(v, best);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, best);
+    for(float lane : lanes)
+        result = maximum ? std::max(result, lane) : std::min(result, lane);
+#endif
+    for(; index < count; index++)
+        if (maximum ? values[index] > result : values[index] < result)
+            result = values[index];
+    return result;
+}
+
+template<bool maximum> static int32_t extremeInt(const int32_t* values, unsigned int count)
+{
+    unsigned int index = 0;
+    int32_t result = maximum ? std::numeric_limits<int32_t>::min() : std::numeric_limits<int32_t>::max();
+#ifdef __SSE2__
+    __m128i best = _mm_set1_epi32(result);
+    for(; index + 4 <= count; index += 4)
+    {
+        //SSE2 has no 32 bit min and max, select with a compare mask instead.
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + index));
+        __m128i take = maximum ? _mm_cmpgt_epi32(v, best) : _mm_cmplt_epi32(v, best);
+        best = _mm_or_si128(_mm_and_si128(take, v), _mm_andnot_si128(take, best));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, best);
+    for(int32_t lane : lanes)
+        result = maximum ? std::max(result, lane) : std::min(result, lane);
+#endif
+    for(; index < count; index++)
+        result = maximum ? std::max(result, values[index]) : std::min(result, values[index]);
+    return result;
+}
+
+static void scaleFloats(float* values, unsigned int count, float factor)
+{
+    unsigned int index = 0;
+#ifdef __SSE2__
+    __m128 f = _mm_set1_ps(factor);
+    for(; index + 4 <= count; index += 4)
+        _mm_storeu_ps(values + index, _mm_mul_ps(_mm_loadu_ps(values + index), f));
+#endif
+    for(; index < count; index++)
+        values[index] *= factor;
+}
+
+static void scaleInts(int32_t* values, unsigned int count, double factor)
+{
+    //SSE2 has no 32 bit multiply, and the result saturates like other conversions to int32, so this stays scalar.
+    for(unsigned int index=0; index<count; index++)
+        values[index] = GssArray::toInt32(values[index] * factor);
+}
+
+//Adds [other] to [values], or [amount] to each value when [other] is nullptr.
+static void addFloats(float* values, const float* other, float amount, unsigned int count)
+{
+    unsigned int index = 0;
+#ifdef __SSE2__
+    __m128 a = _mm_set1_ps(amount);
+    for(; index + 4 <= count; index += 4)
+    {
+        __m128 add = other ? _mm_loadu_ps(other + index) : a;
+        _mm_storeu_ps(values + index, _mm_add_ps(_mm_loadu_ps(values + index), add));
+    }
+#endif
+    for(; index < count; index++)
+        values[index] += other ? other[index] : amount;
+}
+
+//Like addFloats, wraps around on overflow.
+static void addInts(int32_t* values, const int32_t* other, int32_t amount, unsigned int count)
+{
+    unsigned int index = 0;
+#ifdef __SSE2__
+    __m128i a = _mm_set1_epi32(amount);
+    for(; index + 4 <= count; index += 4)
+    {
+        __m128i add = other ? _mm_loadu_si128((const __m128i*)(other + index)) : a;
+        _mm_storeu_si128((__m128i*)(values + index), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(values + index)), add));
+    }
+#endif
+    for(; index < count; index++)
+        values[index] = int32_t(uint32_t(values[index]) + uint32_t(other ? other[index] : amount));
+}
+
+static double dotFloats(const float* a, const float* b, unsigned int count)
+{
+    unsigned int index = 0;
+    double result = 0.0;
+#ifdef __SSE2__
+    __m128d total_low = _mm_setzero_pd();
+    __m128d total_high = _mm_setzero_pd();
+    for(; index + 4 <= count; index += 4)
+    {
+        __m128 va = _mm_loadu_ps(a + index);
+        __m128 vb = _mm_loadu_ps(b + index);
+        total_low = _mm_add_pd(total_low, _mm_mul_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb)));
+        total_high = _mm_add_pd(total_high, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(va, va)), _mm_cvtps_pd(_mm_movehl_ps(vb, vb))));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(total_low, total_high));
+    result = lanes[0] + lanes[1];
+#endif
+    for(; index < count; index++)
+        result += double(a[index]) * double(b[index]);
+    return result;
+}
+
+static int64_t dotInts(const int32_t* a, const int32_t* b, unsigned int count)
+{
+    //SSE2 only has an unsigned 32x32->64 bit multiply, so this stays scalar.
+    int64_t result = 0;
+    for(unsigned int index=0; index<count; index++)
+        result += int64_t(a[index]) * int64_t(b[index]);
+    return result;
+}
+
+//Counts the values >= [threshold], and copies them to [target] in order when it is not nullptr.
+static unsigned int filterFloats(const float* values, unsigned int count, float threshold, float* target)
+{
+    unsigned int index = 0;
+    unsigned int result = 0;
+#ifdef __SSE2__
+    __m128 t = _mm_set1_ps(threshold);
+    for(; index + 4 <= count; index += 4)
+    {
+        int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(values + index), t));
+        for(int lane=0; lane<4; lane++)
+        {
+            if (mask & (1 << lane))
+            {
+                if (target)
+                    target[result] = values[index + lane];
+                result++;
+            }
+        }
+    }
+#endif
+    for(; index < count; index++)
+    {
+        if (values[index] >= threshold)
+        {
+            if (target)
+                target[result] = values[index];
+            result++;
+        }
+    }
+    return result;
+}
+
+static unsigned int filterInts(const int32_t* values, unsigned int count, int32_t threshold, int32_t* target)
+{
+    unsigned int index = 0;
+    unsigned int result = 0;
+#ifdef __SSE2__
+    __m128i t = _mm_set1_epi32(threshold);
+    for(; index + 4 <= count; index += 4)
+    {
+        __m128i below = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(values + index)), t);
+        int mask = ~_mm_movemask_ps(_mm_castsi128_ps(below));
+        for(int lane=0; lane<4; lane++)
+        {
+            if (mask & (1 << lane))
+            {
+                if (target)
+                    target[result] = values[index + lane];
+                result++;
+            }
+        }
+    }
+#endif
+    for(; index < count; index++)
+    {
+        if (values[index] >= threshold)
+        {
+            if (target)
+                target[result] = values[index];
+            result++;
+        }
+    }
+    return result;
+}
+
+static GssArray* getArrayParameter(GssNativeFunctionCallData& data, unsigned int index, const char* function_name)
+{
+    GssArray* array = data.getArray(index);
+    if (!array)
+        throw GssRuntimeException(string(function_name) + "() needs an array as parameter " + string(int(index + 1)));
+    return array;
+}
+
+//Second array parameter, which needs the same element type and length as the first.
+static GssArray* getMatchingArrayParameter(GssNativeFunctionCallData& data, GssArray* first, const char* function_name)
+{
+    GssArray* array = getArrayParameter(data, 1, function_name);
+    if (array->element_type != first->element_type || array->length != first->length)
+        throw GssRuntimeException(string(function_name) + "() needs arrays of the same type and length");
+    return array;
+}
+
+static void createArray(GssNativeFunctionCallData& data, GssArray::ElementType element_type)
+{
+    if (data.isList(0))
+    {
+        unsigned int length = data.getListLength(0);
+        GssArray* array = data.returnArray(element_type, length);
+        for(unsigned int index=0; index<length; index++)
+        {
+            if (element_type == GssArray::ElementType::float32)
+                array->getFloats()[index] = data.getListNumber(0, index);
+            else
+                array->getInts()[index] = GssArray::toInt32(data.getListNumber(0, index));
+        }
+        return;
+    }
+    if (!data.isInt(0) || data.getInt64(0) < 0)
+        throw GssRuntimeException("Array size needs to be a positive integer or a list of numbers");
+    int64_t length = data.getInt64(0);
+    if (length > data.getMaxArrayLength())
+        throw GssRuntimeException("Array size " + string(std::to_string(length)) + " does not fit in the heap");
+    data.returnArray(element_type, length);
+}
+
+void GssArrayFunctions::addTo(GssEngine& engine)
+{
+    engine.addNativeFunction("float_array", [](GssNativeFunctionCallData& data)
+    {
+        createArray(data, GssArray::ElementType::float32);
+    });
+    engine.addNativeFunction("int_array", [](GssNativeFunctionCallData& data)
+    {
+        createArray(data, GssArray::ElementType::int32);
+    });
+    engine.addNativeFunction("array_length", [](GssNativeFunctionCallData& data)
+    {
+        data.returnInt(getArrayParameter(data, 0, "array_length")->length);
+    });
+    engine.addNativeFunction("array_sum", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_sum");
+        if (array->element_type == GssArray::ElementType::float32)
+            data.returnDouble(sumFloats(array->getFloats(), array->length));
+        else
+            data.returnInt64(sumInts(array->getInts(), array->length));
+    });
+    engine.addNativeFunction("array_min", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_min");
+        if (array->length == 0)
+            data.returnNone();
+        else if (array->element_type == GssArray::ElementType::float32)
+            data.returnDouble(extremeFloat<false>(array->getFloats(), array->length));
+        else
+            data.returnInt(extremeInt<false>(array->getInts(), array->length));
+    });
+    engine.addNativeFunction("array_max", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_max");
+        if (array->length == 0)
+            data.returnNone();
+        else if (array->element_type == GssArray::ElementType::float32)
+            data.returnDouble(extremeFloat<true>(array->getFloats(), array->length));
+        else
+            data.returnInt(extremeInt<true>(array->getInts(), array->length));
+    });
+    engine.addNativeFunction("array_scale", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_scale");
+        if (!data.isNumber(1))
+            throw GssRuntimeException("array_scale() needs a number as factor");
+        if (array->element_type == GssArray::ElementType::float32)
+            scaleFloats(array->getFloats(), array->length, data.getDouble(1));
+        else
+            scaleInts(array->getInts(), array->length, data.getDouble(1));
+    });
+    engine.addNativeFunction("array_add", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_add");
+        GssArray* other = nullptr;
+        if (!data.isNumber(1))
+            other = getMatchingArrayParameter(data, array, "array_add");
+        if (array->element_type == GssArray::ElementType::float32)
+            addFloats(array->getFloats(), other ? other->getFloats() : nullptr, data.getDouble(1), array->length);
+        else
+            addInts(array->getInts(), other ? other->getInts() : nullptr, GssArray::toInt32(data.getDouble(1)), array->length);
+    });
+    engine.addNativeFunction("array_dot", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_dot");
+        GssArray* other = getMatchingArrayParameter(data, array, "array_dot");
+        if (array->element_type == GssArray::ElementType::float32)
+            data.returnDouble(dotFloats(array->getFloats(), other->getFloats(), array->length));
+        else
+            data.returnInt64(dotInts(array->getInts(), other->getInts(), array->length));
+    });
+    engine.addNativeFunction("array_sort", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_sort");
+        if (array->element_type == GssArray::ElementType::float32)
+        {
+            //NaNs have no order, they go to the end.
+            float* values = array->getFloats();
+            float* end = std::partition(values, values + array->length, [](float f) { return f == f; });
+            std::sort(values, end);
+        }else{
+            std::sort(array->getInts(), array->getInts() + array->length);
+        }
+    });
+    engine.addNativeFunction("array_filter", [](GssNativeFunctionCallData& data)
+    {
+        GssArray* array = getArrayParameter(data, 0, "array_filter");
+        if (!data.isNumber(1))
+            throw GssRuntimeException("array_filter() needs a number as threshold");
+        double threshold = data.getDouble(1);
+        GssArray::ElementType element_type = array->element_type;
+        if (element_type == GssArray::ElementType::float32)
+        {
+            unsigned int count = filterFloats(array->getFloats(), array->length, threshold, nullptr);
+            GssArray* result = data.returnArray(element_type, count);
+            //returnArray can run the GC, which moves the source array.
+            array = data.getArray(0);
+            filterFloats(array->getFloats(), array->length, threshold, result->getFloats());
+        }else{
+            //Integers >= threshold are the integers >= the rounded up threshold.
+            threshold = std::ceil(threshold);
+            if (!(threshold <= std::numeric_limits<int32_t>::max()))
+            {
+                data.returnArray(element_type, 0);
+                return;
+            }
+            int32_t int_threshold = GssArray::toInt32(threshold);
+            unsigned int count = filterInts(array->getInts(), array->length, int_threshold, nullptr);
+            GssArray* result = data.returnArray(element_type, count);
+            array = data.getArray(0);
+            filterInts(array->getInts(), array->length, int_threshold, result->getInts());
+        }
+    });
+}
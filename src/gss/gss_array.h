@@ -0,0 +1,24 @@
+#ifndef GSS_ARRAY_H
+#define GSS_ARRAY_H
+
+class GssEngine;
+
+/*
+    Built-in functions for GssArray values, packed float32 or int32 numbers in the script heap.
+    These need to be added before GssEngine::load(), like other native functions:
+        float_array(size or list), int_array(size or list): create a zero filled array, or a copy of a list of numbers.
+        array_length(a)
+        array_sum(a), array_min(a), array_max(a), array_dot(a, b)
+        array_scale(a, factor), array_add(a, b or number): change [a] in place.
+        array_sort(a): in place, ascending.
+        array_filter(a, threshold): new array with the elements >= threshold.
+    Arrays are indexed like lists (a[i], a[i] = x). The bulk functions run as SSE2 kernels on x86-64,
+    and as plain loops elsewhere.
+*/
+class GssArrayFunctions
+{
+public:
+    static void addTo(GssEngine& engine);
+};
+
+#endif//GSS_ARRAY_H
@@ -1,9 +1,22 @@
 #include "gss_compiler.h"
+#include "gss_module.h"
+#include "gss_register_lowering.h"
+#include "gss_memory.h"
 
 #include "logging.h"
 
+#include <algorithm>
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
+
+//Index in [binary_operators] of the operators above && and ||, which are compiled as jumps instead.
+static constexpr unsigned int logical_operand_precedence = 2;
+//Function bodies up to this many instructions get copied into their callers.
+static constexpr unsigned int inline_instruction_limit = 24;
+
 GssCompiler::GssCompiler(GssTokenizer& tokenizer)
-: tokenizer(tokenizer)
+: register_backend(false), lazy_functions(false), module(false), current_line(0), native_function_count(0), visible_global_count(std::numeric_limits<unsigned int>::max()), tokenizer(tokenizer), last_list_literal_start(0), last_list_literal_end(0), module_cache(nullptr)
 {
     binary_operators.push_back({GssToken::Type::logical_or});
     binary_operators.push_back({GssToken::Type::logical_and});
@@ -21,12 +34,442 @@ void GssCompiler::setNativeFunctions(std::vector<GssNativeFunction>& functions)
 {
     for(GssNativeFunction& func : functions)
         global_vars.push_back(func.name);
+    native_function_count = global_vars.size();
+}
+
+void GssCompiler::setRegisterBackend(bool enabled)
+{
+    register_backend = enabled;
+}
+
+void GssCompiler::setLazyFunctions(bool enabled)
+{
+    lazy_functions = enabled;
+}
+
+void GssCompiler::setModuleCache(GssModuleCache* cache)
+{
+    module_cache = cache;
 }
 
 void GssCompiler::compile()
 {
     global = true;
+    if (lazy_functions)
+    {
+        lazy_source = std::make_shared<GssLazySource>();
+        lazy_source->register_backend = register_backend;
+    }
     parseBlock(0);
+    if (lazy_functions)
+        instructions.emplace_back(GssInstruction::Type::end_program);
+    markLine(current_line);
+    optimizeDirectCalls();
+    if (!lazy_functions)
+    {
+        std::vector<unsigned int> compiled_functions;
+        for(unsigned int function_index=0; function_index<functions.size(); function_index++)
+            compiled_functions.push_back(function_index);
+        allocateScratchLists(compiled_functions);
+    }
+    inlineSmallFunctions();
+    if (register_backend)
+    {
+        GssRegisterLowering lowering(instructions, functions, instruction_lines);
+        lowering.run();
+    }
+    debug_info.build(instruction_lines, functions);
+}
+
+std::shared_ptr<GssModule> GssCompiler::compileModule(string name)
+{
+    global = true;
+    module = true;
+    parseBlock(0);
+    markLine(current_line);
+
+    std::shared_ptr<GssModule> result = std::make_shared<GssModule>();
+    result->name = name;
+    result->imports = imports;
+    result->instructions = instructions;
+    result->instruction_lines = instruction_lines;
+    result->string_table = string_table;
+    result->number_table = number_table;
+    result->functions = functions;
+    result->global_vars = global_vars;
+    result->external_globals = external_globals;
+    result->external_globals.resize(global_vars.size(), false);
+    result->function_global_indices = function_global_indices;
+    result->call_sites = call_sites;
+    result->list_reads = list_reads;
+    result->list_arguments = list_arguments;
+    return result;
+}
+
+void GssCompiler::compileFunction(unsigned int function_index, unsigned int base_address)
+{
+    const GssLazyFunction& lazy_function = lazy_source->functions[function_index];
+    global = false;
+    visible_global_count = lazy_function.visible_global_count;
+    local_vars = lazy_function.parameters;
+    current_line = lazy_function.body_position.line_number;
+
+    unsigned int address = instructions.size();
+    instructions.emplace_back(GssInstruction::Type::ensure_locals, local_vars.size());
+    parseBlock(lazy_function.body_indent);
+    addFinalReturn(address);
+    markLine(current_line);
+    functions[function_index].address = address;
+    functions[function_index].end_address = instructions.size();
+    applyDirectCalls(lazy_source->static_functions);
+    static_natives = lazy_source->static_natives;
+    allocateScratchLists({function_index});
+    if (lazy_source->register_backend)
+    {
+        //Only lower the new body, the rest of the instructions is already done.
+        std::vector<GssFunctionInfo> body_function = {functions[function_index]};
+        GssRegisterLowering lowering(instructions, body_function, instruction_lines);
+        lowering.run();
+        functions[function_index] = body_function[0];
+    }
+    //Compiled as if the body starts at 0, move it to its place after the program.
+    for(GssInstruction& instruction : instructions)
+        if (instruction.isJump())
+            instruction.data.i += base_address;
+    functions[function_index].address += base_address;
+    functions[function_index].end_address += base_address;
+}
+
+//Return none at the end of a function body, unless the body already ends with a return that nothing jumps past.
+void GssCompiler::addFinalReturn(unsigned int address)
+{
+    bool needed = instructions.back().type != GssInstruction::Type::return_from_function;
+    for(unsigned int index=address; index<instructions.size(); index++)
+        if (instructions[index].isJump() && instructions[index].data.i == int(instructions.size()))
+            needed = true;
+    if (needed)
+    {
+        instructions.emplace_back(GssInstruction::Type::push_none);
+        instructions.emplace_back(GssInstruction::Type::return_from_function);
+    }
+}
+
+void GssCompiler::markLine(int line_number)
+{
+    instruction_lines.resize(instructions.size(), current_line);
+    current_line = line_number;
+}
+
+/*
+    Calls to a top level function that is never assigned anything else can skip the global lookup.
+    The push of the function variant is replaced by a placeholder for the return value,
+    and the call itself jumps directly to the function.
+*/
+void GssCompiler::optimizeDirectCalls()
+{
+    std::vector<int> assign_count;
+    assign_count.resize(global_vars.size(), 0);
+    for(const GssInstruction& instruction : instructions)
+        if (instruction.type == GssInstruction::Type::assign_global_by_index)
+            assign_count[instruction.data.i]++;
+    for(unsigned int index=0; index<lazy_assign_counts.size(); index++)
+        assign_count[index] += lazy_assign_counts[index];
+
+    //Map globals to the function they hold, only the assignment of the function definition itself is allowed.
+    std::vector<int> static_functions;
+    static_functions.resize(global_vars.size(), -1);
+    for(unsigned int function_index=0; function_index<functions.size(); function_index++)
+    {
+        int global_index = function_global_indices[function_index];
+        if (global_index > -1 && assign_count[global_index] == 1)
+            static_functions[global_index] = function_index;
+    }
+    static_natives.resize(global_vars.size(), false);
+    for(unsigned int index=0; index<native_function_count; index++)
+        static_natives[index] = assign_count[index] == 0;
+    if (lazy_source)
+    {
+        lazy_source->static_functions = static_functions;
+        lazy_source->static_natives = static_natives;
+    }
+    applyDirectCalls(static_functions);
+}
+
+void GssCompiler::applyDirectCalls(const std::vector<int>& static_functions)
+{
+    for(const CallSite& call_site : call_sites)
+    {
+        int function_index = static_functions[instructions[call_site.callee_instruction_index].data.i];
+        if (function_index < 0)
+            continue;
+        //Argument count mismatches keep the generic call, so behaviour does not change.
+        if (functions[function_index].parameter_count != call_site.argument_count)
+            continue;
+        GssInstruction::Type call_type = GssInstruction::Type::call_script;
+        if (instructions[call_site.call_instruction_index].type == GssInstruction::Type::tail_call_function)
+            call_type = GssInstruction::Type::tail_call_script;
+        instructions[call_site.callee_instruction_index] = GssInstruction(GssInstruction::Type::push_none);
+        instructions[call_site.call_instruction_index] = GssInstruction(call_type, function_index);
+    }
+}
+
+/*
+    List literals that never outlive the call of the function they are in are created in the scratch room of that call
+    instead of on the heap (see GssMemory::reserveScratch): literals that are only indexed or iterated over, and literals
+    that are passed to a native function or to a scratch parameter of a script function.
+    A parameter is a scratch parameter when the function only indexes it, iterates over it, or passes it on to another
+    scratch parameter, any other use could store or return it.
+    Each literal gets a fixed place in the scratch room, so a literal in a loop reuses the list of the previous iteration,
+    which is no longer in use by then. Literals in global code stay on the heap, as global code has no call to release them.
+*/
+void GssCompiler::allocateScratchLists(const std::vector<unsigned int>& compiled_functions)
+{
+    std::vector<int> body_function;
+    body_function.resize(instructions.size(), -1);
+    std::vector<bool> read_only;
+    read_only.resize(instructions.size(), false);
+    for(unsigned int index : list_reads)
+        read_only[index] = true;
+    std::vector<int> argument_of;
+    argument_of.resize(instructions.size(), -1);
+    for(unsigned int index=0; index<list_arguments.size(); index++)
+        argument_of[list_arguments[index].value_instruction_index] = index;
+    std::vector<bool> native_call;
+    native_call.resize(instructions.size(), false);
+    for(const CallSite& call_site : call_sites)
+    {
+        const GssInstruction& callee = instructions[call_site.callee_instruction_index];
+        if (callee.type == GssInstruction::Type::push_global_by_index && callee.data.i < int(static_natives.size()) && static_natives[callee.data.i])
+            native_call[call_site.call_instruction_index] = true;
+    }
+    //Native functions cannot keep a reference to their arguments. A script tail call releases the scratch room of the current call before the callee runs.
+    auto isScratchArgument = [&](const ListArgument& argument, bool allow_tail_call)
+    {
+        const GssInstruction& call = instructions[argument.call_instruction_index];
+        if (call.type == GssInstruction::Type::call_function || call.type == GssInstruction::Type::tail_call_function)
+            return bool(native_call[argument.call_instruction_index]);
+        if (call.type == GssInstruction::Type::call_script || (allow_tail_call && call.type == GssInstruction::Type::tail_call_script))
+            return argument.argument_index < 32 && (functions[call.data.i].scratch_parameters & (uint32_t(1) << argument.argument_index));
+        return false;
+    };
+
+    //Start with all parameters as scratch parameters and drop the ones with other uses till nothing changes,
+    //so functions that pass a parameter on to each other, or to themselves, keep it as scratch parameter.
+    for(unsigned int function_index : compiled_functions)
+    {
+        GssFunctionInfo& function = functions[function_index];
+        for(unsigned int index=function.address; index<function.end_address; index++)
+            body_function[index] = function_index;
+        function.scratch_size = 0;
+        function.scratch_parameters = function.parameter_count >= 32 ? 0xffffffff : (uint32_t(1) << function.parameter_count) - 1;
+    }
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(unsigned int function_index : compiled_functions)
+        {
+            GssFunctionInfo& function = functions[function_index];
+            for(unsigned int index=function.address; index<function.end_address; index++)
+            {
+                const GssInstruction& instruction = instructions[index];
+                if (instruction.type != GssInstruction::Type::push_local_by_index || instruction.data.i >= 32)
+                    continue;
+                uint32_t bit = uint32_t(1) << instruction.data.i;
+                if (!(function.scratch_parameters & bit))
+                    continue;
+                if (read_only[index] || (argument_of[index] > -1 && isScratchArgument(list_arguments[argument_of[index]], true)))
+                    continue;
+                function.scratch_parameters &= ~bit;
+                changed = true;
+            }
+        }
+    }
+
+    std::vector<unsigned int> scratch_literals;
+    for(unsigned int index : list_reads)
+        scratch_literals.push_back(index);
+    for(const ListArgument& argument : list_arguments)
+        if (isScratchArgument(argument, false))
+            scratch_literals.push_back(argument.value_instruction_index);
+    for(unsigned int index : scratch_literals)
+    {
+        GssInstruction& instruction = instructions[index];
+        if (instruction.type != GssInstruction::Type::push_empty_list || body_function[index] < 0 || instruction.data.i > 0xff)
+            continue;
+        GssFunctionInfo& function = functions[body_function[index]];
+        if (function.scratch_size >= (1 << 23))
+            continue;
+        instruction = GssInstruction(GssInstruction::Type::push_scratch_list, int((function.scratch_size << 8) | instruction.data.i));
+        function.scratch_size += sizeof(GssList) + sizeof(GssVariant) * instruction.getScratchLength();
+    }
+}
+
+//The instructions from [start] on are only a list literal or a local variable, so the list they push is not stored anywhere yet.
+bool GssCompiler::isListValue(unsigned int start)
+{
+    if (start == last_list_literal_start && instructions.size() == last_list_literal_end)
+        return true;
+    return instructions.size() == start + 1 && instructions[start].type == GssInstruction::Type::push_local_by_index;
+}
+
+/*
+    Direct calls to small functions that do not call themselves are replaced by a copy of the function body.
+    The arguments and locals of the copy get slots after the locals of the calling function, and returns
+    become jumps to the end of the copy, which leaves the return value where the call would have left it.
+    Only the bodies as they were before inlining are copied, so functions calling each other are inlined one level deep.
+    Calls from global code are kept, as global code has no local slots.
+*/
+void GssCompiler::inlineSmallFunctions()
+{
+    std::vector<int> body_function;
+    body_function.resize(instructions.size(), -1);
+    std::vector<int> local_count;
+    std::vector<bool> inlinable;
+    for(unsigned int function_index=0; function_index<functions.size(); function_index++)
+    {
+        const GssFunctionInfo& function = functions[function_index];
+        local_count.push_back(0);
+        //Stubs of lazy functions have no body to copy yet.
+        bool ok = instructions[function.address].type == GssInstruction::Type::ensure_locals && function.end_address - function.address <= inline_instruction_limit + 1;
+        for(unsigned int index=function.address; index<function.end_address; index++)
+        {
+            const GssInstruction& instruction = instructions[index];
+            body_function[index] = function_index;
+            if (instruction.type == GssInstruction::Type::ensure_locals)
+                local_count.back() = std::max(local_count.back(), instruction.data.i);
+            //A for-in loop keeps hidden values on the stack, which a return from inside the loop would leave behind.
+            if (instruction.type == GssInstruction::Type::iterator_start)
+                ok = false;
+            if ((instruction.type == GssInstruction::Type::call_script || instruction.type == GssInstruction::Type::tail_call_script) && instruction.data.i == int(function_index))
+                ok = false;
+        }
+        inlinable.push_back(ok);
+    }
+
+    std::vector<bool> inline_call;
+    inline_call.resize(instructions.size(), false);
+    std::vector<bool> removed;
+    removed.resize(instructions.size(), false);
+    std::vector<int> extra_locals;
+    extra_locals.resize(functions.size(), 0);
+    std::vector<unsigned int> extra_scratch_size;
+    extra_scratch_size.resize(functions.size(), 0);
+    bool any_inline_call = false;
+    for(const CallSite& call_site : call_sites)
+    {
+        const GssInstruction& call = instructions[call_site.call_instruction_index];
+        if (call.type != GssInstruction::Type::call_script && call.type != GssInstruction::Type::tail_call_script)
+            continue;
+        int caller = body_function[call_site.call_instruction_index];
+        if (caller < 0 || caller == call.data.i || !inlinable[call.data.i])
+            continue;
+        //The placeholder for the return value is not needed, the copy leaves its result on top of the stack.
+        removed[call_site.callee_instruction_index] = true;
+        inline_call[call_site.call_instruction_index] = true;
+        extra_locals[caller] = std::max(extra_locals[caller], local_count[call.data.i]);
+        extra_scratch_size[caller] = std::max(extra_scratch_size[caller], functions[call.data.i].scratch_size);
+        any_inline_call = true;
+    }
+    if (!any_inline_call)
+        return;
+
+    std::vector<GssInstruction> result;
+    std::vector<int> result_lines;
+    std::vector<unsigned int> new_index;
+    new_index.resize(instructions.size() + 1);
+    std::vector<unsigned int> relocations; //Jumps in [result] that still have a target in the old instructions.
+    for(unsigned int index=0; index<instructions.size(); index++)
+    {
+        new_index[index] = result.size();
+        if (removed[index])
+            continue;
+        const GssInstruction& call = instructions[index];
+        if (!inline_call[index])
+        {
+            if (call.isJump())
+                relocations.push_back(result.size());
+            result.push_back(call);
+            result_lines.resize(result.size(), instruction_lines[index]);
+            continue;
+        }
+
+        const GssFunctionInfo& callee = functions[call.data.i];
+        int base = local_count[body_function[index]];
+        for(int slot=callee.parameter_count - 1; slot >= 0; slot--)
+            result.emplace_back(GssInstruction::Type::assign_local_by_index, base + slot);
+        for(int slot=callee.parameter_count; slot < local_count[call.data.i]; slot++)
+        {
+            result.emplace_back(GssInstruction::Type::push_none);
+            result.emplace_back(GssInstruction::Type::assign_local_by_index, base + slot);
+        }
+        //Copy the body without the ensure_locals instructions and the final return.
+        unsigned int body_start = callee.address + 1;
+        unsigned int body_end = callee.end_address - 1;
+        std::vector<unsigned int> body_index;
+        unsigned int copy_size = 0;
+        for(unsigned int body=body_start; body<body_end; body++)
+        {
+            body_index.push_back(copy_size);
+            if (instructions[body].type != GssInstruction::Type::ensure_locals)
+                copy_size++;
+        }
+        body_index.push_back(copy_size);
+        unsigned int copy_start = result.size();
+        for(unsigned int body=body_start; body<body_end; body++)
+        {
+            GssInstruction instruction = instructions[body];
+            switch(instruction.type)
+            {
+            case GssInstruction::Type::ensure_locals:
+                continue;
+            case GssInstruction::Type::push_local_by_index:
+            case GssInstruction::Type::assign_local_by_index:
+                instruction.data.i += base;
+                break;
+            //The scratch lists of the copy get room after the ones of the calling function.
+            case GssInstruction::Type::push_scratch_list:
+                instruction.data.i += functions[body_function[index]].scratch_size << 8;
+                break;
+            case GssInstruction::Type::return_from_function:
+                instruction = GssInstruction(GssInstruction::Type::jump, body_end);
+                break;
+            //A tail call would replace the frame of the calling function.
+            case GssInstruction::Type::tail_call_function:
+                instruction.type = GssInstruction::Type::call_function;
+                break;
+            case GssInstruction::Type::tail_call_script:
+                instruction.type = GssInstruction::Type::call_script;
+                break;
+            default:
+                break;
+            }
+            if (instruction.isJump())
+            {
+                unsigned int target = std::min(std::max(unsigned(instruction.data.i), body_start), body_end);
+                instruction.data.i = copy_start + body_index[target - body_start];
+            }
+            result.push_back(instruction);
+        }
+        //Errors in the copy are reported at the call.
+        result_lines.resize(result.size(), instruction_lines[index]);
+    }
+    new_index[instructions.size()] = result.size();
+
+    for(unsigned int relocation : relocations)
+        result[relocation].data.i = new_index[result[relocation].data.i];
+    for(unsigned int function_index=0; function_index<functions.size(); function_index++)
+    {
+        GssFunctionInfo& function = functions[function_index];
+        function.address = new_index[function.address];
+        function.end_address = new_index[function.end_address];
+        if (extra_locals[function_index] > 0)
+            result[function.address].data.i = local_count[function_index] + extra_locals[function_index];
+        function.scratch_size += extra_scratch_size[function_index];
+    }
+    instructions = result;
+    instruction_lines = result_lines;
+    call_sites.clear();
 }
 
 void GssCompiler::parseBlock(int minimal_indent)
@@ -50,52 +493,61 @@ void GssCompiler::parseBlock(int minimal_indent)
             throw GssCompilerException(token, "Inconsistent indentation (got: " + string(token.indent_amount) + " expected: " + string(start_indent) + ")");
         if (token.indent_amount < start_indent)
             break;
+        markLine(token.line_number);
         if (token.type == GssToken::Type::name)
         {
             if (token.data == "if")
             {
                 tokenizer.get();
-                parseExpression();
-                instructions.emplace_back(GssInstruction::Type::jump_if_zero);
-                int jump_instruction_index = instructions.size() - 1;
+                std::vector<unsigned int> false_jumps;
+                parseCondition(false_jumps);
                 expect(GssToken::Type::colon);
                 expect(GssToken::Type::end_of_line);
                 parseBlock(start_indent + 1);
-                instructions[jump_instruction_index].data.i = instructions.size();
+                for(unsigned int index : false_jumps)
+                    instructions[index].data.i = instructions.size();
             }else if (token.data == "while")
             {
                 tokenizer.get();
                 int while_jump_location = instructions.size();
-                parseExpression();
-                instructions.emplace_back(GssInstruction::Type::jump_if_zero);
-                int jump_instruction_index = instructions.size() - 1;
+                std::vector<unsigned int> false_jumps;
+                parseCondition(false_jumps);
                 expect(GssToken::Type::colon);
                 expect(GssToken::Type::end_of_line);
                 parseBlock(start_indent + 1);
+                markLine(token.line_number);
                 instructions.emplace_back(GssInstruction::Type::jump, while_jump_location);
-                instructions[jump_instruction_index].data.i = instructions.size();
+                for(unsigned int index : false_jumps)
+                    instructions[index].data.i = instructions.size();
             }else if (token.data == "for")
             {
                 tokenizer.get();
-                parseStatement(false);
-                expect(GssToken::Type::semi_colon);
-                int jump_condition_target = instructions.size();
                 parseExpression();
-                instructions.emplace_back(GssInstruction::Type::jump_if_zero, 0);
-                int jump_to_end_instruction_index = instructions.size() - 1;
-                instructions.emplace_back(GssInstruction::Type::jump, 0);
-                int jump_past_condition_index = instructions.size() - 1;
-                instructions.emplace_back(GssInstruction::Type::jump, 0);
-                int jump_increment_target = instructions.size();
-                expect(GssToken::Type::semi_colon);
-                parseStatement(false);
-                expect(GssToken::Type::colon);
-                instructions.emplace_back(GssInstruction::Type::jump, jump_condition_target);
-                instructions[jump_past_condition_index].data.i = instructions.size();
-                expect(GssToken::Type::end_of_line);
-                parseBlock(start_indent + 1);
-                instructions.emplace_back(GssInstruction::Type::jump, jump_increment_target);
-                instructions[jump_to_end_instruction_index].data.i = instructions.size();
+                if (tokenizer.peek().type == GssToken::Type::name && tokenizer.peek().data == "in")
+                {
+                    parseForIn(start_indent, token.line_number);
+                }else{
+                    parseAssignment(false);
+                    expect(GssToken::Type::semi_colon);
+                    int jump_condition_target = instructions.size();
+                    std::vector<unsigned int> false_jumps;
+                    parseCondition(false_jumps);
+                    instructions.emplace_back(GssInstruction::Type::jump, 0);
+                    int jump_past_condition_index = instructions.size() - 1;
+                    instructions.emplace_back(GssInstruction::Type::jump, 0);
+                    int jump_increment_target = instructions.size();
+                    expect(GssToken::Type::semi_colon);
+                    parseStatement(false);
+                    expect(GssToken::Type::colon);
+                    instructions.emplace_back(GssInstruction::Type::jump, jump_condition_target);
+                    instructions[jump_past_condition_index].data.i = instructions.size();
+                    expect(GssToken::Type::end_of_line);
+                    parseBlock(start_indent + 1);
+                    markLine(token.line_number);
+                    instructions.emplace_back(GssInstruction::Type::jump, jump_increment_target);
+                    for(unsigned int index : false_jumps)
+                        instructions[index].data.i = instructions.size();
+                }
             }else if (token.data == "var")
             {
                 tokenizer.get();
@@ -120,11 +572,17 @@ void GssCompiler::parseBlock(int minimal_indent)
                 if (token.type == GssToken::Type::assign)
                 {
                     token = tokenizer.get();
-                    parseExpression();
                     if (global)
                     {
+                        int skip_instruction_index = instructions.size();
+                        if (minimal_indent == 0)
+                            instructions.emplace_back(GssInstruction::Type::jump_if_global_kept, 0);
+                        parseExpression();
                         instructions.emplace_back(GssInstruction::Type::assign_global_by_index, getGlobal(var_name));
+                        if (minimal_indent == 0)
+                            instructions[skip_instruction_index].data.i = instructions.size();
                     }else{
+                        parseExpression();
                         instructions.emplace_back(GssInstruction::Type::assign_local_by_index, local_vars.size() - 1);
                     }
                 }
@@ -154,20 +612,45 @@ void GssCompiler::parseBlock(int minimal_indent)
                 expect(GssToken::Type::colon);
                 expect(GssToken::Type::end_of_line);
                 int jump_instruction_location = instructions.size();
-                int function_index = addGlobal(token, function_name);
+                int global_index = addGlobal(token, function_name);
+                int function_index = functions.size();
+                functions.emplace_back(function_name, jump_instruction_location + 1, local_vars.size());
+                function_global_indices.push_back(minimal_indent == 0 ? global_index : -1);
                 instructions.emplace_back(GssInstruction::Type::jump, 0);
-                global = false;
-                instructions.emplace_back(GssInstruction::Type::ensure_locals, local_vars.size());
-                parseBlock(start_indent + 1);
-                if (instructions.back().type != GssInstruction::Type::return_from_function)
+                if (lazy_functions)
                 {
-                    instructions.emplace_back(GssInstruction::Type::push_none);
-                    instructions.emplace_back(GssInstruction::Type::return_from_function);
+                    skipFunctionBody(start_indent + 1);
+                    instructions.emplace_back(GssInstruction::Type::compile_function, function_index);
+                }else{
+                    global = false;
+                    instructions.emplace_back(GssInstruction::Type::ensure_locals, local_vars.size());
+                    parseBlock(start_indent + 1);
+                    addFinalReturn(jump_instruction_location + 1);
                 }
                 instructions[jump_instruction_location].data.i = instructions.size();
-                instructions.emplace_back(GssInstruction::Type::push_script_function, jump_instruction_location + 1);
-                instructions.emplace_back(GssInstruction::Type::assign_global_by_index, function_index);
+                functions[function_index].end_address = instructions.size();
+                instructions.emplace_back(GssInstruction::Type::push_script_function, function_index);
+                instructions.emplace_back(GssInstruction::Type::assign_global_by_index, global_index);
                 global = true;
+            }else if (token.data == "import")
+            {
+                if (!global || minimal_indent > 0)
+                    throw GssCompilerException(token, "Import only allowed at the top level.");
+                tokenizer.get();
+                string name = expect(GssToken::Type::name).data;
+                expect(GssToken::Type::end_of_line);
+                parseImport(token, name);
+            }else if (token.data == "yield")
+            {
+                tokenizer.get();
+                expect(GssToken::Type::end_of_line);
+                instructions.emplace_back(GssInstruction::Type::suspend, int(GssWaitReason::yield));
+            }else if (token.data == "wait" || token.data == "wait_event")
+            {
+                tokenizer.get();
+                parseExpression();
+                expect(GssToken::Type::end_of_line);
+                instructions.emplace_back(GssInstruction::Type::suspend, int(token.data == "wait" ? GssWaitReason::time : GssWaitReason::event));
             }else if (token.data == "return")
             {
                 if (global)
@@ -175,6 +658,9 @@ void GssCompiler::parseBlock(int minimal_indent)
                 tokenizer.get();
                 parseExpression();
                 expect(GssToken::Type::end_of_line);
+                //The return stays after a tail call, for native functions and for jumps that target it.
+                if (instructions.back().type == GssInstruction::Type::call_function)
+                    instructions.back().type = GssInstruction::Type::tail_call_function;
                 instructions.emplace_back(GssInstruction::Type::return_from_function);
             }else{
                 parseStatement(true);
@@ -196,31 +682,54 @@ void GssCompiler::parseValue()
             throw GssCompilerException(token, "Unexpected: " + token.toString() + " expected: ')'");
     }else if (token.type == GssToken::Type::left_square_bracket)
     {
-        instructions.emplace_back(GssInstruction::Type::push_empty_list, token.data.toFloat());
+        unsigned int list_instruction_index = instructions.size();
+        instructions.emplace_back(GssInstruction::Type::push_empty_list);
+        int entry_count = 0;
         token = tokenizer.peek();
         if (token.type != GssToken::Type::right_square_bracket)
         {
-            int index = 0;
             while(true)
             {
                 parseExpression();
                 instructions.emplace_back(GssInstruction::Type::add_to_table, token.data.toFloat());
+                entry_count++;
                 token = tokenizer.peek();
                 if (token.type != GssToken::Type::comma)
                     break;
                 tokenizer.get();
-                index++;
             }
         }
         expect(GssToken::Type::right_square_bracket);
-    }else if (token.type == GssToken::Type::number)
+        instructions[list_instruction_index].data.i = entry_count;
+        last_list_literal_start = list_instruction_index;
+        last_list_literal_end = instructions.size();
+    }else if (token.type == GssToken::Type::left_curly_bracket)
     {
-        if (token.data.find(".") > -1)
+        unsigned int dictionary_instruction_index = instructions.size();
+        instructions.emplace_back(GssInstruction::Type::push_empty_dictionary);
+        int entry_count = 0;
+        if (tokenizer.peek().type != GssToken::Type::right_curly_bracket)
         {
-            instructions.emplace_back(GssInstruction::Type::push_float, token.data.toFloat());
-        }else{
-            instructions.emplace_back(GssInstruction::Type::push_int, token.data.toInt());
+            while(true)
+            {
+                GssToken key = tokenizer.get();
+                if (key.type != GssToken::Type::name && key.type != GssToken::Type::string)
+                    throw GssCompilerException(key, "Unexpected: " + key.toString() + " expected: member name");
+                expect(GssToken::Type::colon);
+                parseExpression();
+                instructions.emplace_back(GssInstruction::Type::add_to_dictionary, addToStringTable(key.data));
+                entry_count++;
+                if (tokenizer.peek().type != GssToken::Type::comma)
+                    break;
+                tokenizer.get();
+            }
         }
+        expect(GssToken::Type::right_curly_bracket);
+        //Reserve room for all the members of the literal up front.
+        instructions[dictionary_instruction_index].data.i = entry_count;
+    }else if (token.type == GssToken::Type::number)
+    {
+        parseNumber(token, false);
     }else if (token.type == GssToken::Type::string)
     {
         instructions.emplace_back(GssInstruction::Type::push_string_from_string_table, addToStringTable(token.data));
@@ -242,7 +751,17 @@ void GssCompiler::parseValue()
             instructions.emplace_back(GssInstruction::Type::push_int, 0);
             done = true;
         }
-        if (!global)
+        if (token.data == "vec2" && tokenizer.peek().type == GssToken::Type::left_bracket)
+        {
+            tokenizer.get();
+            parseExpression();
+            expect(GssToken::Type::comma);
+            parseExpression();
+            expect(GssToken::Type::right_bracket);
+            instructions.emplace_back(GssInstruction::Type::make_vec2);
+            done = true;
+        }
+        if (!done && !global)
         {
             int index = 0;
             for(const string& v : local_vars)
@@ -259,6 +778,14 @@ void GssCompiler::parseValue()
         if (!done)
         {
             int global_var_index = getGlobal(token.data);
+            if (global_var_index < 0 && module)
+            {
+                //Left for the linker to find in the importing program.
+                global_vars.push_back(token.data);
+                external_globals.resize(global_vars.size(), false);
+                external_globals.back() = true;
+                global_var_index = global_vars.size() - 1;
+            }
             if (global_var_index > -1)
             {
                 instructions.emplace_back(GssInstruction::Type::push_global_by_index, global_var_index);
@@ -272,6 +799,27 @@ void GssCompiler::parseValue()
     }
 }
 
+void GssCompiler::parseNumber(const GssToken& token, bool negative)
+{
+    if (token.data.find(".") > -1)
+    {
+        double value = strtod(token.data.c_str(), nullptr);
+        instructions.emplace_back(GssInstruction::Type::push_float, addToNumberTable(negative ? -value : value));
+    }else{
+        //Script integers have 48 bits, literals that do not fit in the 32 bit operand take their value from the number table.
+        //The sign is applied before the range check, so the smallest integer can be written as a negated literal.
+        int64_t value = strtoll(token.data.c_str(), nullptr, 10);
+        if (negative)
+            value = -value;
+        if (value < GssVariant::integer_min || value > GssVariant::integer_max)
+            throw GssCompilerException(token, "Integer does not fit in 48 bits: " + string(negative ? "-" : "") + token.data);
+        if (value == int64_t(int32_t(value)))
+            instructions.emplace_back(GssInstruction::Type::push_int, int(value));
+        else
+            instructions.emplace_back(GssInstruction::Type::push_wide_int, addToNumberTable(double(value)));
+    }
+}
+
 void GssCompiler::parseUnary()
 {
     GssToken token = tokenizer.peek();
@@ -292,11 +840,16 @@ void GssCompiler::parseUnary()
     else if (token.type == GssToken::Type::minus)
     {
         tokenizer.get();
+        if (tokenizer.peek().type == GssToken::Type::number)
+        {
+            parseNumber(tokenizer.get(), true);
+            return;
+        }
         parseValue();
         if (instructions.back().type == GssInstruction::Type::push_int)
             instructions.back().data.i = -instructions.back().data.i;
-        else if (instructions.back().type == GssInstruction::Type::push_float)
-            instructions.back().data.f = -instructions.back().data.f;
+        else if (instructions.back().type == GssInstruction::Type::push_float || instructions.back().type == GssInstruction::Type::push_wide_int)
+            instructions.back().data.i = addToNumberTable(-number_table[instructions.back().data.i]);
         else
             instructions.emplace_back(GssInstruction::Type::negative);
         return;
@@ -306,12 +859,15 @@ void GssCompiler::parseUnary()
 
 void GssCompiler::parseSubscript()
 {
+    unsigned int value_start = instructions.size();
     parseUnary();
     while(true)
     {
         GssToken token = tokenizer.peek();
         if (token.type == GssToken::Type::left_square_bracket)
         {
+            if (isListValue(value_start))
+                list_reads.push_back(value_start);
             tokenizer.get();
             parseExpression();
             expect(GssToken::Type::right_square_bracket);
@@ -322,19 +878,29 @@ void GssCompiler::parseSubscript()
         {
             tokenizer.get();
             string member = expect(GssToken::Type::name).data;
-            instructions.emplace_back(GssInstruction::Type::get_from_table_by_string_table, addToStringTable(member));
+            GssInstruction::Type type = GssInstruction::Type::get_from_table_by_string_table;
+            if (member == "x")
+                type = GssInstruction::Type::get_member_x;
+            else if (member == "y")
+                type = GssInstruction::Type::get_member_y;
+            instructions.emplace_back(type, addToStringTable(member));
             continue;
         }
         if (token.type == GssToken::Type::left_bracket)
         {
             tokenizer.get();
+            int callee_instruction_index = instructions.size() - 1;
             int arg_count = 0;
+            std::vector<ListArgument> arguments;
             token = tokenizer.peek();
             if (token.type != GssToken::Type::right_bracket)
             {
                 while(true)
                 {
+                    unsigned int argument_start = instructions.size();
                     parseExpression();
+                    if (isListValue(argument_start))
+                        arguments.push_back({argument_start, 0, (unsigned int)arg_count});
                     arg_count++;
                     token = tokenizer.peek();
                     if (token.type == GssToken::Type::comma)
@@ -346,6 +912,13 @@ void GssCompiler::parseSubscript()
                 }
             }
             instructions.emplace_back(GssInstruction::Type::call_function, arg_count);
+            if (instructions[callee_instruction_index].type == GssInstruction::Type::push_global_by_index)
+                call_sites.push_back({(unsigned int)callee_instruction_index, (unsigned int)instructions.size() - 1, (unsigned int)arg_count});
+            for(ListArgument& argument : arguments)
+            {
+                argument.call_instruction_index = instructions.size() - 1;
+                list_arguments.push_back(argument);
+            }
             expect(GssToken::Type::right_bracket);
             continue;
         }
@@ -353,6 +926,57 @@ void GssCompiler::parseSubscript()
     }
 }
 
+void GssCompiler::parseCondition(std::vector<unsigned int>& false_jumps)
+{
+    if (!parseLogicalChain(false_jumps))
+    {
+        false_jumps.push_back(instructions.size());
+        instructions.emplace_back(GssInstruction::Type::jump_if_zero);
+    }
+}
+
+/*
+    && and || short-circuit: each operand is tested with a conditional jump as soon as it is on the stack,
+    so the right hand side is never evaluated when the left hand side decides the result.
+    Returns false, with the value on the stack, when the expression has no && or ||.
+    Otherwise nothing is left on the stack: the code falls through when the result is true, and [false_jumps] need to be patched to the false target.
+*/
+bool GssCompiler::parseLogicalChain(std::vector<unsigned int>& false_jumps)
+{
+    parseBinaryOperator(logical_operand_precedence);
+    GssToken::Type type = tokenizer.peek().type;
+    if (type != GssToken::Type::logical_and && type != GssToken::Type::logical_or)
+        return false;
+    std::vector<unsigned int> true_jumps;
+    std::vector<unsigned int> and_false_jumps; //Jumps out of the current && group, to the next || alternative or the false target.
+    while(true)
+    {
+        type = tokenizer.peek().type;
+        if (type == GssToken::Type::logical_and)
+        {
+            and_false_jumps.push_back(instructions.size());
+            instructions.emplace_back(GssInstruction::Type::jump_if_zero);
+        }else if (type == GssToken::Type::logical_or)
+        {
+            true_jumps.push_back(instructions.size());
+            instructions.emplace_back(GssInstruction::Type::jump_if_not_zero);
+            for(unsigned int index : and_false_jumps)
+                instructions[index].data.i = instructions.size();
+            and_false_jumps.clear();
+        }else{
+            false_jumps.push_back(instructions.size());
+            instructions.emplace_back(GssInstruction::Type::jump_if_zero);
+            false_jumps.insert(false_jumps.end(), and_false_jumps.begin(), and_false_jumps.end());
+            break;
+        }
+        tokenizer.get();
+        parseBinaryOperator(logical_operand_precedence);
+    }
+    for(unsigned int index : true_jumps)
+        instructions[index].data.i = instructions.size();
+    return true;
+}
+
 void GssCompiler::parseBinaryOperator(unsigned int precedence)
 {
     if (precedence >= binary_operators.size())
@@ -360,6 +984,20 @@ void GssCompiler::parseBinaryOperator(unsigned int precedence)
         parseSubscript();
         return;
     }
+    if (precedence < logical_operand_precedence)
+    {
+        //As a value, && and || give 1 or 0.
+        std::vector<unsigned int> false_jumps;
+        if (parseLogicalChain(false_jumps))
+        {
+            instructions.emplace_back(GssInstruction::Type::push_int, 1);
+            instructions.emplace_back(GssInstruction::Type::jump, int(instructions.size() + 2));
+            for(unsigned int index : false_jumps)
+                instructions[index].data.i = instructions.size();
+            instructions.emplace_back(GssInstruction::Type::push_int, 0);
+        }
+        return;
+    }
     parseBinaryOperator(precedence + 1);
     GssToken token = tokenizer.peek();
     for(GssToken::Type type : binary_operators[precedence])
@@ -436,9 +1074,210 @@ void GssCompiler::parseExpression()
     parseBinaryOperator(0);
 }
 
+/*
+    Pre-scan of a function body for lazy compiling: only finds where the body ends, and which globals the body might assign,
+    as calls to a function in a global that is assigned anywhere else cannot be direct calls.
+*/
+void GssCompiler::skipFunctionBody(int minimal_indent)
+{
+    GssLazyFunction lazy_function;
+    lazy_function.body_position = tokenizer.getPosition();
+    lazy_function.body_indent = minimal_indent;
+    lazy_function.visible_global_count = global_vars.size();
+    lazy_function.parameters = local_vars;
+    lazy_source->functions.push_back(lazy_function);
+    lazy_assign_counts.resize(global_vars.size(), 0);
+
+    int start_indent = -1;
+    GssToken previous;
+    previous.type = GssToken::Type::end_of_line;
+    while(tokenizer.peek().type != GssToken::Type::end_of_file)
+    {
+        GssToken& token = tokenizer.peek();
+        if (token.type != GssToken::Type::end_of_line)
+        {
+            if (start_indent == -1)
+            {
+                start_indent = token.indent_amount;
+                if (start_indent < minimal_indent)
+                    throw GssCompilerException(token, "No proper indentation (got: " + string(token.indent_amount) + " expected: " + string(minimal_indent) + ")");
+            }
+            if (token.indent_amount < start_indent)
+                break;
+        }
+        bool assigns = token.type >= GssToken::Type::plus_assign && token.type <= GssToken::Type::right_shift_assign;
+        if (token.type == GssToken::Type::assign || assigns || (token.type == GssToken::Type::name && previous.type == GssToken::Type::name && previous.data == "for"))
+        {
+            string name = token.type == GssToken::Type::name ? token.data : previous.data;
+            if (token.type == GssToken::Type::name || previous.type == GssToken::Type::name)
+                for(unsigned int index=0; index<global_vars.size(); index++)
+                    if (global_vars[index] == name)
+                        lazy_assign_counts[index]++;
+        }
+        previous = tokenizer.get();
+    }
+}
+
+/*
+    for x in list:
+    The list and a hidden index stay on the stack during the loop. The list type is checked once by iterator_start,
+    after that iterator_next only compares the index with the list length before it pushes the next entry.
+*/
+void GssCompiler::parseForIn(int block_indent, int line_number)
+{
+    GssToken in_token = tokenizer.get();
+    GssInstruction target = instructions.back();
+    instructions.pop_back();
+    if (target.type == GssInstruction::Type::push_local_by_index)
+        target.type = GssInstruction::Type::assign_local_by_index;
+    else if (target.type == GssInstruction::Type::push_global_by_index)
+        target.type = GssInstruction::Type::assign_global_by_index;
+    else
+        throw GssCompilerException(in_token, "Expected a variable before 'in'");
+    unsigned int list_start = instructions.size();
+    parseExpression();
+    if (isListValue(list_start))
+        list_reads.push_back(list_start);
+    instructions.emplace_back(GssInstruction::Type::iterator_start);
+    int loop_location = instructions.size();
+    instructions.emplace_back(GssInstruction::Type::iterator_next, 0);
+    instructions.push_back(target);
+    expect(GssToken::Type::colon);
+    expect(GssToken::Type::end_of_line);
+    parseBlock(block_indent + 1);
+    markLine(line_number);
+    instructions.emplace_back(GssInstruction::Type::jump, loop_location);
+    instructions[loop_location].data.i = instructions.size();
+    instructions.emplace_back(GssInstruction::Type::pop, 1);
+    instructions.emplace_back(GssInstruction::Type::pop, 1);
+}
+
+/*
+    A module is compiled once by the GssModuleCache, and linked into each program that imports it at the point of the import,
+    after the modules it imports itself. In a module an import only records the dependency, its names are found when linking.
+*/
+void GssCompiler::parseImport(GssToken& token, string name)
+{
+    if (std::find(imports.begin(), imports.end(), name) != imports.end())
+        return;
+    if (module)
+    {
+        imports.push_back(name);
+        return;
+    }
+    if (!module_cache)
+        throw GssCompilerException(token, "Cannot import " + name + ", no modules available");
+    if (std::find(importing.begin(), importing.end(), name) != importing.end())
+        throw GssCompilerException(token, "Circular import of module " + name);
+    std::shared_ptr<const GssModule> imported_module;
+    try
+    {
+        imported_module = module_cache->get(name);
+    }catch(GssTokenizerException e)
+    {
+        throw GssCompilerException(token, "In module " + name + ": " + e.message + ", imported");
+    }catch(GssCompilerException e)
+    {
+        throw GssCompilerException(token, "In module " + name + ": " + e.message + ", imported");
+    }
+    if (!imported_module)
+        throw GssCompilerException(token, "Module not found: " + name);
+    importing.push_back(name);
+    for(const string& dependency : imported_module->imports)
+        parseImport(token, dependency);
+    importing.pop_back();
+    linkModule(token, *imported_module);
+    imports.push_back(name);
+}
+
+//Append the module code at the current point of the global code, with all its references moved to the tables of this program.
+void GssCompiler::linkModule(GssToken& token, const GssModule& linked_module)
+{
+    std::vector<int> global_map;
+    for(unsigned int index=0; index<linked_module.global_vars.size(); index++)
+    {
+        const string& name = linked_module.global_vars[index];
+        if (linked_module.external_globals[index])
+        {
+            int global_index = getGlobal(name);
+            if (global_index < 0)
+                throw GssCompilerException(token, "Module " + linked_module.name + " uses " + name + ", which is not defined before the import");
+            global_map.push_back(global_index);
+        }else{
+            global_map.push_back(addGlobal(token, name));
+        }
+    }
+    std::vector<int> string_map;
+    for(const string& str : linked_module.string_table)
+        string_map.push_back(addToStringTable(str));
+    std::vector<int> number_map;
+    for(double number : linked_module.number_table)
+        number_map.push_back(addToNumberTable(number));
+
+    markLine(token.line_number);
+    unsigned int base = instructions.size();
+    unsigned int function_base = functions.size();
+    for(GssInstruction instruction : linked_module.instructions)
+    {
+        switch(instruction.type)
+        {
+        case GssInstruction::Type::push_global_by_index:
+        case GssInstruction::Type::assign_global_by_index:
+            instruction.data.i = global_map[instruction.data.i];
+            break;
+        case GssInstruction::Type::push_string_from_string_table:
+        case GssInstruction::Type::get_from_table_by_string_table:
+        case GssInstruction::Type::assign_to_table_by_string_table:
+        case GssInstruction::Type::add_to_dictionary:
+        case GssInstruction::Type::get_member_x:
+        case GssInstruction::Type::get_member_y:
+            instruction.data.i = string_map[instruction.data.i];
+            break;
+        case GssInstruction::Type::push_float:
+        case GssInstruction::Type::push_wide_int:
+            instruction.data.i = number_map[instruction.data.i];
+            break;
+        case GssInstruction::Type::push_script_function:
+            instruction.data.i += function_base;
+            break;
+        default:
+            break;
+        }
+        if (instruction.isJump())
+            instruction.data.i += base;
+        instructions.push_back(instruction);
+    }
+    instruction_lines.insert(instruction_lines.end(), linked_module.instruction_lines.begin(), linked_module.instruction_lines.end());
+
+    for(unsigned int index=0; index<linked_module.functions.size(); index++)
+    {
+        GssFunctionInfo function = linked_module.functions[index];
+        function.name = linked_module.name + "." + function.name;
+        function.address += base;
+        function.end_address += base;
+        functions.push_back(function);
+        int global_index = linked_module.function_global_indices[index];
+        function_global_indices.push_back(global_index < 0 ? -1 : global_map[global_index]);
+    }
+    //Module functions are always compiled, they only need an entry to keep the lazy functions indexed like the function table.
+    if (lazy_source)
+        lazy_source->functions.resize(functions.size(), GssLazyFunction());
+    for(const CallSite& call_site : linked_module.call_sites)
+        call_sites.push_back({call_site.callee_instruction_index + base, call_site.call_instruction_index + base, call_site.argument_count});
+    for(unsigned int index : linked_module.list_reads)
+        list_reads.push_back(index + base);
+    for(const ListArgument& argument : linked_module.list_arguments)
+        list_arguments.push_back({argument.value_instruction_index + base, argument.call_instruction_index + base, argument.argument_index});
+}
+
 void GssCompiler::parseStatement(bool with_end_of_line)
 {
     parseExpression();
+    parseAssignment(with_end_of_line);
+}
+
+void GssCompiler::parseAssignment(bool with_end_of_line)
+{
     GssToken& token = tokenizer.get();
     if (token.type == GssToken::Type::assign)
     {
@@ -454,6 +1293,8 @@ void GssCompiler::parseStatement(bool with_end_of_line)
             instructions.emplace_back(GssInstruction::Type::assign_to_table, last_instruction.data.i);
             break;
         case GssInstruction::Type::get_from_table_by_string_table:
+        case GssInstruction::Type::get_member_x:
+        case GssInstruction::Type::get_member_y:
             instructions.emplace_back(GssInstruction::Type::assign_to_table_by_string_table, last_instruction.data.i);
             break;
         case GssInstruction::Type::push_local_by_index:
@@ -495,23 +1336,36 @@ int GssCompiler::addToStringTable(string value)
     return string_table.size() - 1;
 }
 
+int GssCompiler::addToNumberTable(double value)
+{
+    for(unsigned int n=0; n<number_table.size(); n++)
+    {
+        if (memcmp(&number_table[n], &value, sizeof(value)) == 0)
+            return n;
+    }
+    number_table.push_back(value);
+    return number_table.size() - 1;
+}
+
 int GssCompiler::addGlobal(GssToken& reference_token, string name)
 {
-    for(const string& v : global_vars)
-        if (v == name)
-            throw GssCompilerException(reference_token, "Duplicate global variable definition: " + name);
+    for(unsigned int index=0; index<global_vars.size(); index++)
+    {
+        if (global_vars[index] != name)
+            continue;
+        if (index < external_globals.size() && external_globals[index])
+            throw GssCompilerException(reference_token, "Global variable used before its definition: " + name);
+        throw GssCompilerException(reference_token, "Duplicate global variable definition: " + name);
+    }
     global_vars.push_back(name);
     return global_vars.size() - 1;
 }
 
 int GssCompiler::getGlobal(string name)
 {
-    int index = 0;
-    for(const string& v : global_vars)
-    {
-        if (v == name)
+    unsigned int count = std::min<size_t>(global_vars.size(), visible_global_count);
+    for(unsigned int index=0; index<count; index++)
+        if (global_vars[index] == name)
             return index;
-        index++;
-    }
     return -1;
 }
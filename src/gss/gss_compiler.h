@@ -3,11 +3,39 @@
 
 #include "gss_tokenizer.h"
 #include "gss_instructions.h"
+#include "gss_debug_info.h"
 #include "gss_native_function_call_data.h"
 
+#include <memory>
+
+/*
+    Everything needed to compile a function body that a lazy compile skipped.
+*/
+class GssLazyFunction
+{
+public:
+    GssTokenizer::Position body_position;
+    int body_indent;                    //Minimal indent of the body.
+    unsigned int visible_global_count;  //Globals defined before the function, as in a full compile the body can only use those.
+    std::vector<string> parameters;
+};
+
+class GssLazySource
+{
+public:
+    string code;
+    bool register_backend;
+    std::vector<GssLazyFunction> functions; //Indexed like the function table.
+    std::vector<int> static_functions;      //Per global the function it always holds, or -1, for direct calls from bodies compiled later.
+    std::vector<bool> static_natives;       //Per global if it always holds its native function.
+};
+
+class GssModule;
+class GssModuleCache;
+
 /*
     The GssCompiler takes tokens from the GssTokenizer and turns this into
-    a list of GssInstructions and a static string table.
+    a list of GssInstructions, a static string table and a table of number constants.
 */
 class GssCompiler
 {
@@ -15,31 +43,127 @@ public:
     GssCompiler(GssTokenizer& tokenizer);
     
     void setNativeFunctions(std::vector<GssNativeFunction>& functions);
+    void setRegisterBackend(bool enabled); //Lower function bodies to three-address instructions on local slots.
+    //Only scan over function bodies and leave a compile_function stub, the bodies are compiled with compileFunction() on their first call.
+    void setLazyFunctions(bool enabled);
+    void setModuleCache(GssModuleCache* cache); //Where `import name` gets its modules from.
     void compile();
+    //Compile the code as a module for `import`: only parsed, the optimizations run on the program it is linked into.
+    //Names that the module uses but does not define are left for the linker, the native functions are not needed.
+    std::shared_ptr<GssModule> compileModule(string name);
+    //Compile the body of a function that a lazy compile skipped, to be appended to the program at [base_address]. The tokenizer has to
+    //start at the body, and the tables, [functions] and [global_vars] need to be the ones of the program.
+    //[instructions] and [instruction_lines] start empty and only get the body, so the cost does not depend on the size of the program.
+    //[debug_info] is not changed.
+    void compileFunction(unsigned int function_index, unsigned int base_address);
 
     std::vector<GssInstruction> instructions;
     std::vector<string> string_table;
+    std::vector<double> number_table; //Constants for push_float, so they keep full double precision.
+    std::vector<GssFunctionInfo> functions;
+    std::vector<string> global_vars; //Names of the globals, the native functions first.
+    std::vector<int> instruction_lines; //Source line of each instruction, turned into [debug_info] at the end.
+    GssDebugInfo debug_info;
+    std::shared_ptr<GssLazySource> lazy_source; //Only with lazy functions.
 private:
+    class CallSite
+    {
+    public:
+        unsigned int callee_instruction_index;
+        unsigned int call_instruction_index;
+        unsigned int argument_count;
+    };
+    //A list literal or local variable that is passed as is to a call.
+    class ListArgument
+    {
+    public:
+        unsigned int value_instruction_index;
+        unsigned int call_instruction_index;
+        unsigned int argument_index;
+    };
+
     bool global;
+    bool register_backend;
+    bool lazy_functions;
+    bool module;
+    int current_line;
+    unsigned int native_function_count;
+    unsigned int visible_global_count; //Only the first globals can be used, for function bodies compiled after the whole program.
     
     GssTokenizer& tokenizer;
-    std::vector<string> global_vars;
     std::vector<string> local_vars;
     std::vector< std::vector< GssToken::Type > > binary_operators;
+    std::vector<int> function_global_indices; //Global index of each entry in [functions], or -1 if the function is conditionally defined.
+    std::vector<CallSite> call_sites;
+    std::vector<int> lazy_assign_counts; //Per global the assignments found in skipped function bodies.
+    std::vector<bool> static_natives;
+    unsigned int last_list_literal_start; //Instructions of the last list literal that was parsed, to see if an expression is only that literal.
+    unsigned int last_list_literal_end;
+    std::vector<unsigned int> list_reads; //List literals and local variables that are only indexed or iterated over.
+    std::vector<ListArgument> list_arguments;
+    GssModuleCache* module_cache;
+    std::vector<string> imports;            //Modules imported so far, each is only linked once into a program.
+    std::vector<string> importing;          //Modules that are linking their own imports, to detect circular imports.
+    std::vector<bool> external_globals;     //Only for modules, per global if it is used but not defined by the module.
     
     void parseBlock(int minimal_indent);
+    void skipFunctionBody(int minimal_indent);
+    void parseForIn(int block_indent, int line_number);
+    void parseImport(GssToken& token, string name);
+    void linkModule(GssToken& token, const GssModule& linked_module);
     void parseStatement(bool with_end_of_line);
+    void parseAssignment(bool with_end_of_line); //Rest of a statement of which the first expression is already parsed.
     void parseExpression();
+    void parseCondition(std::vector<unsigned int>& false_jumps); //Expression that is only tested, adds the jumps that need to go to the false target.
+    bool parseLogicalChain(std::vector<unsigned int>& false_jumps);
     void parseBinaryOperator(unsigned int precedence);
     void parseSubscript();
     void parseUnary();
     void parseValue();
+    void parseNumber(const GssToken& token, bool negative);
     
+    void optimizeDirectCalls();
+    void applyDirectCalls(const std::vector<int>& static_functions);
+    void allocateScratchLists(const std::vector<unsigned int>& compiled_functions);
+    bool isListValue(unsigned int start);
+    void inlineSmallFunctions();
+    void addFinalReturn(unsigned int address);
+    void markLine(int line_number); //Instructions added from now on belong to this source line.
+
     GssToken expect(GssToken::Type type);
     
     int addToStringTable(string value);
+    int addToNumberTable(double value);
     int addGlobal(GssToken& reference_token, string name);
     int getGlobal(string name);
+
+    friend class GssModule;
+};
+
+/*
+    A module compiled for `import`, shared by all programs that import it. It holds the instructions and tables
+    of the module on its own, and what the optimizations of the program need to know about its code.
+    The linker copies it into a program, with the globals found by name and all other references moved.
+*/
+class GssModule
+{
+public:
+    string name;
+    std::vector<string> imports; //Modules that the module imports itself, linked before it.
+    std::vector<GssInstruction> instructions;
+    std::vector<int> instruction_lines;
+    std::vector<string> string_table;
+    std::vector<double> number_table;
+    std::vector<GssFunctionInfo> functions;
+    std::vector<string> global_vars;
+    std::vector<bool> external_globals; //Globals the linker needs to find in the program, the others are defined by the module.
+private:
+    std::vector<int> function_global_indices;
+    std::vector<GssCompiler::CallSite> call_sites;
+    std::vector<unsigned int> list_reads;
+    std::vector<GssCompiler::ListArgument> list_arguments;
+
+    friend class GssCompiler;
 };
 
 class GssCompilerException : public std::exception
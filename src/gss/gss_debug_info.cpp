@@ -0,0 +1,52 @@
+#include "gss_debug_info.h"
+
+#include <algorithm>
+
+void GssDebugInfo::build(const std::vector<int>& instruction_lines, const std::vector<GssFunctionInfo>& functions)
+{
+    entries.clear();
+    //Lazily compiled function bodies are appended in the order they are called, so walk along the bodies in address order.
+    std::vector<unsigned int> order;
+    for(unsigned int function_index=0; function_index<functions.size(); function_index++)
+        order.push_back(function_index);
+    std::sort(order.begin(), order.end(), [&functions](unsigned int a, unsigned int b) { return functions[a].address < functions[b].address; });
+    unsigned int order_index = 0;
+    for(unsigned int index=0; index<instruction_lines.size(); index++)
+    {
+        while(order_index < order.size() && index >= functions[order[order_index]].end_address)
+            order_index++;
+        int current_function = -1;
+        if (order_index < order.size() && index >= functions[order[order_index]].address)
+            current_function = order[order_index];
+
+        if (entries.empty() || entries.back().line != instruction_lines[index] || entries.back().function_index != current_function)
+            entries.push_back({index, instruction_lines[index], current_function});
+    }
+}
+
+void GssDebugInfo::append(const std::vector<int>& instruction_lines, unsigned int start, int function_index)
+{
+    for(unsigned int index=0; index<instruction_lines.size(); index++)
+        if (index == 0 || entries.back().line != instruction_lines[index])
+            entries.push_back({start + index, instruction_lines[index], function_index});
+}
+
+int GssDebugInfo::getLine(unsigned int instruction_pointer) const
+{
+    const Entry* entry = find(instruction_pointer);
+    return entry ? entry->line : 0;
+}
+
+int GssDebugInfo::getFunctionIndex(unsigned int instruction_pointer) const
+{
+    const Entry* entry = find(instruction_pointer);
+    return entry ? entry->function_index : -1;
+}
+
+const GssDebugInfo::Entry* GssDebugInfo::find(unsigned int instruction_pointer) const
+{
+    auto it = std::upper_bound(entries.begin(), entries.end(), instruction_pointer, [](unsigned int ip, const Entry& entry) { return ip < entry.start; });
+    if (it == entries.begin())
+        return nullptr;
+    return &*(it - 1);
+}
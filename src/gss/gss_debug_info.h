@@ -0,0 +1,36 @@
+#ifndef GSS_DEBUG_INFO_H
+#define GSS_DEBUG_INFO_H
+
+#include <vector>
+
+#include "gss_instructions.h"
+
+/*
+    Maps instruction pointers back to source lines and functions, for runtime errors and tools like the GssProfiler.
+    Kept apart from the instructions so it does not take cache space while running, and run-length encoded:
+    there is only an entry where the line or function changes, found with a binary search.
+*/
+class GssDebugInfo
+{
+public:
+    void build(const std::vector<int>& instruction_lines, const std::vector<GssFunctionInfo>& functions);
+    //Add a lazily compiled function body that is appended at [start], after all instructions so far. [instruction_lines] only has the lines of the body.
+    void append(const std::vector<int>& instruction_lines, unsigned int start, int function_index);
+
+    int getLine(unsigned int instruction_pointer) const;
+    int getFunctionIndex(unsigned int instruction_pointer) const; //-1 for global code.
+    unsigned int getEntryCount() const { return entries.size(); }
+private:
+    class Entry
+    {
+    public:
+        unsigned int start; //First instruction pointer of this run.
+        int line;
+        int function_index;
+    };
+    std::vector<Entry> entries;
+
+    const Entry* find(unsigned int instruction_pointer) const;
+};
+
+#endif//GSS_DEBUG_INFO_H
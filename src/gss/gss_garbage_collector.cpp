@@ -12,25 +12,37 @@ GssGarbageCollector::GssGarbageCollector(GssMemory* memory)
 void GssGarbageCollector::run()
 {
     old_memory = memory->memory;
-    memory->memory = calloc(memory->memory_size, 1);
+    unsigned int old_allocation_point = memory->allocation_point;
+    memory->memory = memory->spare_memory ? memory->spare_memory : calloc(memory->memory_size, 1);
     memory->allocation_point = 0;
+    //Scratch lists keep their position, only the references in them are updated.
+    memcpy(memory->get(memory->scratch_point), ((char*)old_memory) + memory->scratch_point, memory->memory_size - memory->scratch_point);
 
     memory->stack_location = processListAt(memory->stack_location);
-    memory->globals_location = processListAt(memory->globals_location);
+    for(GssVariant& global : memory->globals)
+        relocateVariant(global, &global);
+    for(unsigned int position : memory->scratch_lists)
+    {
+        GssList* list = (GssList*)memory->get(position);
+        for(unsigned int n=0; n<list->current_length; n++)
+            copyVariant(list->position + sizeof(GssVariant) * n, list->position + sizeof(GssVariant) * n);
+    }
     
-    free(old_memory);
+    memory->recycleBuffer(old_memory, old_allocation_point);
 }
 
 unsigned int GssGarbageCollector::processListAt(unsigned int old_position)
 {
+    if (old_position >= memory->scratch_point)
+        return old_position;
     if (address_relocation_map.find(old_position) != address_relocation_map.end())
         return address_relocation_map[old_position];
     GssList* old_list = (GssList*)get(old_position);
-    unsigned int new_position = memory->allocate(sizeof(GssList));
+    unsigned int new_position = memory->allocateForCollection(sizeof(GssList));
     GssList* new_list = (GssList*)memory->get(new_position);
     new_list->current_length = old_list->current_length;
     new_list->reserved_length = std::min(new_list->current_length + 16, old_list->reserved_length);
-    new_list->position = memory->allocate(sizeof(GssVariant) * new_list->reserved_length);
+    new_list->position = memory->allocateForCollection(sizeof(GssVariant) * new_list->reserved_length);
     
     for(unsigned int n=0; n<old_list->current_length; n++)
     {
@@ -40,30 +52,71 @@ unsigned int GssGarbageCollector::processListAt(unsigned int old_position)
     return new_position;
 }
 
+unsigned int GssGarbageCollector::processDictionaryAt(unsigned int old_position)
+{
+    if (address_relocation_map.find(old_position) != address_relocation_map.end())
+        return address_relocation_map[old_position];
+    GssDictionary* old_dictionary = (GssDictionary*)get(old_position);
+    uint32_t slot_count = memory->shapes.getSlotCount(old_dictionary->shape);
+    unsigned int new_position = memory->allocateForCollection(sizeof(GssDictionary));
+    GssDictionary* new_dictionary = (GssDictionary*)memory->get(new_position);
+    new_dictionary->shape = old_dictionary->shape;
+    new_dictionary->reserved_length = std::min(slot_count + 4, old_dictionary->reserved_length);
+    new_dictionary->position = memory->allocateForCollection(sizeof(GssVariant) * new_dictionary->reserved_length);
+    //Register before copying the values, so a dictionary that refers to itself is not copied twice.
+    address_relocation_map[old_position] = new_position;
+
+    for(unsigned int n=0; n<slot_count; n++)
+    {
+        copyVariant(old_dictionary->position + sizeof(GssVariant) * n, new_dictionary->position + sizeof(GssVariant) * n);
+    }
+    return new_position;
+}
+
+unsigned int GssGarbageCollector::processBlockAt(unsigned int old_position, unsigned int size)
+{
+    if (address_relocation_map.find(old_position) != address_relocation_map.end())
+        return address_relocation_map[old_position];
+    unsigned int new_position = memory->allocateForCollection(size);
+    memcpy(memory->get(new_position), get(old_position), size);
+    address_relocation_map[old_position] = new_position;
+    return new_position;
+}
+
 void GssGarbageCollector::copyVariant(unsigned int old_position, unsigned int new_position)
 {
-    GssVariant* old_v = (GssVariant*)get(old_position);
-    GssVariant* new_v = (GssVariant*)memory->get(new_position);
-    *new_v = *old_v;
-    if (old_v->type == GssVariant::Type::string)
+    relocateVariant(*(GssVariant*)get(old_position), (GssVariant*)memory->get(new_position));
+}
+
+void GssGarbageCollector::relocateVariant(GssVariant old_v, GssVariant* new_v)
+{
+    *new_v = old_v;
+    GssVariant::Type type = old_v.getType();
+    if (type == GssVariant::Type::string)
     {
-        if (address_relocation_map.find(old_v->data.i) != address_relocation_map.end())
+        unsigned int old_string_position = old_v.getReference();
+        if (address_relocation_map.find(old_string_position) != address_relocation_map.end())
         {
-            new_v->data.i = address_relocation_map[old_v->data.i];
+            new_v->setReference(type, address_relocation_map[old_string_position]);
         }else{
-            uint32_t* old_ptr = (uint32_t*)get(old_v->data.i);
+            uint32_t* old_ptr = (uint32_t*)get(old_string_position);
             uint32_t str_len = *old_ptr;
             old_ptr++;
-            new_v->data.i = memory->allocate(sizeof(uint32_t) + str_len);
-            uint32_t* new_ptr = (uint32_t*)memory->get(new_v->data.i);
+            unsigned int new_string_position = memory->allocateForCollection(sizeof(uint32_t) + str_len);
+            uint32_t* new_ptr = (uint32_t*)memory->get(new_string_position);
             *new_ptr = str_len;
             new_ptr++;
             memcpy(new_ptr, old_ptr, str_len);
-            address_relocation_map[old_v->data.i] = new_v->data.i;
+            new_v->setReference(type, new_string_position);
+            address_relocation_map[old_string_position] = new_string_position;
         }
     }
-    if (old_v->type == GssVariant::Type::list)
-        new_v->data.i = processListAt(old_v->data.i);
-    if (old_v->type == GssVariant::Type::dictionary)
-        LOG(ERROR) << "Copy missing for dictionary type";
+    if (type == GssVariant::Type::list)
+        new_v->setReference(type, processListAt(old_v.getReference()));
+    if (type == GssVariant::Type::dictionary)
+        new_v->setReference(type, processDictionaryAt(old_v.getReference()));
+    if (type == GssVariant::Type::array)
+        new_v->setReference(type, processBlockAt(old_v.getReference(), GssArray::getSize(((GssArray*)get(old_v.getReference()))->length)));
+    if (type == GssVariant::Type::vec2)
+        new_v->setReference(type, processBlockAt(old_v.getReference(), sizeof(GssVec2)));
 }
@@ -20,7 +20,10 @@ private:
     void* get(unsigned int location) { return ((char*)old_memory) + location; }
     
     unsigned int processListAt(unsigned int old_position);
+    unsigned int processDictionaryAt(unsigned int old_position);
+    unsigned int processBlockAt(unsigned int old_position, unsigned int size); //Data without references: arrays and vec2s.
     void copyVariant(unsigned int old_position, unsigned int new_position);
+    void relocateVariant(GssVariant old_v, GssVariant* new_v); //The old value is a copy, so the target can be where it came from, as for the globals.
 };
 
 #endif//GSS_GARBAGE_COLLECTOR_H
@@ -1,5 +1,10 @@
 #include "gss_instructions.h"
 
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
 string GssInstruction::toString() const
 {
     switch(type)
@@ -11,9 +16,15 @@ string GssInstruction::toString() const
     case Type::push_int:
         return "PUSH " + string(data.i);
     case Type::push_float:
-        return "PUSH " + string(data.f);
+        return "PUSH NUMBER[" + string(data.i) + "]";
+    case Type::push_wide_int:
+        return "PUSH INT NUMBER[" + string(data.i) + "]";
     case Type::push_empty_list:
         return "PUSH []";
+    case Type::push_scratch_list:
+        return "PUSH [] SCRATCH +" + string(int(getScratchOffset())) + " LEN " + string(int(getScratchLength()));
+    case Type::push_empty_dictionary:
+        return "PUSH {}";
     case Type::push_string_from_string_table:
         return "PUSH STR[" + string(data.i) + "]";
     case Type::push_script_function:
@@ -24,8 +35,17 @@ string GssInstruction::toString() const
         return "JUMP ZERO -> " + string(data.i);
     case Type::jump_if_not_zero:
         return "JUMP NOT ZERO -> " + string(data.i);
+    case Type::jump_if_global_kept:
+        return "JUMP GLOBAL KEPT -> " + string(data.i);
     case Type::pop:
         return "POP " + string(data.i);
+    case Type::iterator_start:
+        return "ITERATOR START";
+    case Type::iterator_next:
+        return "ITERATOR NEXT, DONE -> " + string(data.i);
+    
+    case Type::suspend:
+        return "SUSPEND " + string(data.i);
     
     case Type::push_global_by_index:
         return "PUSH GLOBAL [" + string(data.i) + "]";
@@ -47,11 +67,29 @@ string GssInstruction::toString() const
         return "GET MEMBER STR[" + string(data.i) + "]";
     case Type::assign_to_table_by_string_table:
         return "ASSIGN MEMBER STR[" + string(data.i) + "]";
+    case Type::add_to_dictionary:
+        return "ADD MEMBER STR[" + string(data.i) + "]";
+    case Type::get_member_x:
+        return "GET X STR[" + string(data.i) + "]";
+    case Type::get_member_y:
+        return "GET Y STR[" + string(data.i) + "]";
+    case Type::make_vec2:
+        return "VEC2";
     
     case Type::call_function:
         return "CALL " + string(data.i);
+    case Type::call_script:
+        return "CALL FUNC[" + string(data.i) + "]";
+    case Type::tail_call_function:
+        return "TAIL CALL " + string(data.i);
+    case Type::tail_call_script:
+        return "TAIL CALL FUNC[" + string(data.i) + "]";
     case Type::ensure_locals:
         return "ENSURE LOCALS " + string(data.i);
+    case Type::compile_function:
+        return "COMPILE FUNC[" + string(data.i) + "]";
+    case Type::end_program:
+        return "END";
     case Type::return_from_function:
         return "RET";
     
@@ -98,6 +136,135 @@ string GssInstruction::toString() const
         return "DIV";
     case Type::modulo:
         return "MOD";
+    
+    case Type::local_move:
+        return "L[" + string(getRegisterTarget()) + "] = L[" + string(getRegisterA()) + "]";
+    case Type::local_load_int:
+        return "L[" + string(getRegisterTarget()) + "] = " + string(getRegisterImmediate());
+    case Type::local_less:
+    case Type::local_less_equal:
+    case Type::local_greater:
+    case Type::local_greater_equal:
+    case Type::local_add:
+    case Type::local_substract:
+    case Type::local_multiply:
+    case Type::local_division:
+    case Type::local_modulo:
+        return "L[" + string(getRegisterTarget()) + "] = " + GssInstruction(getStackOperation(type)).toString() + " L[" + string(getRegisterA()) + "] L[" + string(getRegisterB()) + "]";
+    case Type::count:
+        break;
     }
     return "?";
 }
+
+bool GssInstruction::isJump() const
+{
+    return type == Type::jump || type == Type::jump_if_zero || type == Type::jump_if_not_zero || type == Type::iterator_next || type == Type::jump_if_global_kept;
+}
+
+GssInstruction::Type GssInstruction::getRegisterOperation(Type stack_operation)
+{
+    switch(stack_operation)
+    {
+    case Type::boolean_less: return Type::local_less;
+    case Type::boolean_less_equal: return Type::local_less_equal;
+    case Type::boolean_greater: return Type::local_greater;
+    case Type::boolean_greater_equal: return Type::local_greater_equal;
+    case Type::add: return Type::local_add;
+    case Type::substract: return Type::local_substract;
+    case Type::multiply: return Type::local_multiply;
+    case Type::division: return Type::local_division;
+    case Type::modulo: return Type::local_modulo;
+    default: return Type::nop;
+    }
+}
+
+GssInstruction::Type GssInstruction::getStackOperation(Type register_operation)
+{
+    switch(register_operation)
+    {
+    case Type::local_less: return Type::boolean_less;
+    case Type::local_less_equal: return Type::boolean_less_equal;
+    case Type::local_greater: return Type::boolean_greater;
+    case Type::local_greater_equal: return Type::boolean_greater_equal;
+    case Type::local_add: return Type::add;
+    case Type::local_substract: return Type::substract;
+    case Type::local_multiply: return Type::multiply;
+    case Type::local_division: return Type::division;
+    case Type::local_modulo: return Type::modulo;
+    default: return Type::nop;
+    }
+}
+
+static_assert(int(GssInstruction::Type::count) <= 0x80, "Instruction type needs to fit in the 7 bits of the packed encoding");
+
+GssCode::GssCode()
+: words(nullptr), word_count(0), capacity(0)
+{
+}
+
+GssCode::~GssCode()
+{
+    free(words);
+}
+
+std::vector<GssInstruction> GssCode::decode() const
+{
+    std::vector<GssInstruction> instructions;
+    instructions.reserve(word_count);
+    for(unsigned int index=0; index<word_count; index++)
+        instructions.push_back(decode(index));
+    return instructions;
+}
+
+void GssCode::encode(const std::vector<GssInstruction>& instructions)
+{
+    free(words);
+    words = nullptr;
+    word_count = 0;
+    capacity = 0;
+    wide_operands.clear();
+    append(instructions);
+}
+
+void GssCode::append(const std::vector<GssInstruction>& instructions)
+{
+    reserve(word_count + instructions.size());
+    for(const GssInstruction& instruction : instructions)
+    {
+        int32_t operand = instruction.data.i;
+        if ((int32_t(uint32_t(operand) << 8) >> 8) == operand)
+        {
+            words[word_count++] = uint32_t(instruction.type) | (uint32_t(operand) << 8);
+        }else{
+            words[word_count++] = uint32_t(instruction.type) | wide_flag | (uint32_t(wide_operands.size()) << 8);
+            wide_operands.push_back(operand);
+        }
+    }
+}
+
+void GssCode::copyFrom(const GssCode& other)
+{
+    free(words);
+    words = nullptr;
+    word_count = 0;
+    capacity = 0;
+    reserve(other.word_count);
+    memcpy(words, other.words, other.word_count * sizeof(uint32_t));
+    word_count = other.word_count;
+    wide_operands = other.wide_operands;
+}
+
+void GssCode::reserve(unsigned int count)
+{
+    if (count <= capacity && words)
+        return;
+    //The first encode gets an exact fit, appends after that double the room.
+    unsigned int new_capacity = std::max(count, capacity * 2);
+    //realloc keeps the words so far, and the old buffer when it fails.
+    uint32_t* new_words = (uint32_t*)realloc(words, std::max(1u, new_capacity) * sizeof(uint32_t));
+    if (!new_words)
+        throw std::bad_alloc();
+    words = new_words;
+    capacity = new_capacity;
+}
@@ -2,7 +2,9 @@
 #define GSS_INSTRUCTIONS_H
 
 #include <functional>
+#include <vector>
 #include <stdint.h>
+#include <SFML/System.hpp>
 #include "stringImproved.h"
 
 class GssInstruction
@@ -14,13 +16,20 @@ public:
         push_none,
         push_int,
         push_float,
-        push_empty_list,
+        push_wide_int,     //Integer literal that does not fit in 32 bits, data is the index of its value in the number table.
+        push_empty_list,   //data is the number of entries of the literal, the list reserves room for 16 anyway.
+        push_scratch_list, //List literal in the scratch room of the current call, see GssCompiler::allocateScratchLists. data holds the offset in the room << 8 | the length.
+        push_empty_dictionary,
         push_string_from_string_table,
         push_script_function,
         jump,
         jump_if_zero,
         jump_if_not_zero,
+        jump_if_global_kept, //Skips the initializer of a top level variable that kept its value over a GssEngine::reload. The initializer ends with the assign to the global.
         pop,
+        iterator_start,
+        iterator_next,
+        suspend, //Pause the script, data is the GssWaitReason. Waits for time or an event take the seconds or event name from the stack.
         
         push_global_by_index,
         assign_global_by_index,
@@ -33,9 +42,18 @@ public:
         add_to_table,
         get_from_table_by_string_table,
         assign_to_table_by_string_table,
+        add_to_dictionary,
+        get_member_x, //.x and .y: a direct load for vec2 values, the member with string table index [data] for dictionaries.
+        get_member_y,
+        make_vec2,    //vec2(x, y), from the two numbers on the stack.
         
         call_function,
+        call_script,
+        tail_call_function, //Like call_function, but a script function reuses the frame of the current function, for "return f(x)". Followed by a return_from_function for native functions.
+        tail_call_script,   //Like call_script, but reuses the frame of the current function.
         ensure_locals,
+        compile_function, //Stub of a function that is not compiled yet, see GssCompiler::setLazyFunctions.
+        end_program, //End of the global code when lazily compiled function bodies are appended after it.
         return_from_function,
         
         boolean_not,
@@ -60,7 +78,24 @@ public:
         multiply,
         division,
         modulo,
+        
+        //Three-address instructions on local slots, generated by the GssRegisterLowering.
+        local_move,
+        local_load_int,
+        local_less,
+        local_less_equal,
+        local_greater,
+        local_greater_equal,
+        local_add,
+        local_substract,
+        local_multiply,
+        local_division,
+        local_modulo,
+
+        count //Number of instruction types, not an instruction.
     };
+    //Maximum local slot that can be addressed by the three-address instructions.
+    static constexpr int max_register = 0xff;
     union Data {
         float f;
         int32_t i;
@@ -74,7 +109,91 @@ public:
     GssInstruction(Type type, int value) : type(type) { data.i = value; }
     GssInstruction(Type type, unsigned int value) : type(type) { data.i = value; }
     
+    static GssInstruction registerOperation(Type type, int target, int a, int b = 0) { return GssInstruction(type, target | (a << 8) | (b << 16)); }
+    static GssInstruction registerLoadInt(int target, int value) { return GssInstruction(Type::local_load_int, int(target | ((unsigned int)value << 8))); }
+    int getRegisterTarget() const { return data.i & 0xff; }
+    int getRegisterA() const { return (data.i >> 8) & 0xff; }
+    int getRegisterB() const { return (data.i >> 16) & 0xff; }
+    int getRegisterImmediate() const { return data.i >> 8; }
+    unsigned int getScratchOffset() const { return uint32_t(data.i) >> 8; }
+    unsigned int getScratchLength() const { return data.i & 0xff; }
+    void setRegisterTarget(int target) { data.i = (data.i & ~0xff) | target; }
+    
+    bool isJump() const;
+    static Type getRegisterOperation(Type stack_operation); //Returns nop if there is no three-address version of the operation.
+    static Type getStackOperation(Type register_operation);
+    
     string toString() const;
 };
 
+/*
+    Packed form of the instructions as executed by the interpreter: one 32 bit word per instruction, in a single buffer.
+    The low 7 bits hold the type and bit 7 is the wide flag, the high 24 bits a signed operand. Operands that do not fit in 24 bits
+    set the wide flag, and then the 24 bits index the wide operand table instead.
+    Every instruction stays a single word, so instruction pointers are the same as indices in the GssInstruction list it was encoded from.
+    A program only keeps this form, the compiler and the JIT decode the instructions they need. Lazily compiled function bodies are
+    appended, the buffer grows by doubling so appending costs only the size of the body.
+*/
+class GssCode : sf::NonCopyable
+{
+public:
+    GssCode();
+    ~GssCode();
+
+    void encode(const std::vector<GssInstruction>& instructions);
+    void append(const std::vector<GssInstruction>& instructions);
+    void copyFrom(const GssCode& other); //Explicit, as programs are shared and only copied when an engine needs to change its own.
+    GssInstruction decode(unsigned int index) const
+    {
+        uint32_t word = words[index];
+        GssInstruction instruction(GssInstruction::Type(word & type_mask));
+        if (word & wide_flag)
+            instruction.data.i = wide_operands[word >> 8];
+        else
+            instruction.data.i = int32_t(word) >> 8;
+        return instruction;
+    }
+    std::vector<GssInstruction> decode() const; //All instructions, for the compiler to continue on a program.
+    unsigned int size() const { return word_count; }
+    unsigned int getWideOperandCount() const { return wide_operands.size(); }
+private:
+    static constexpr uint32_t type_mask = 0x7f;
+    static constexpr uint32_t wide_flag = 0x80;
+
+    uint32_t* words;
+    unsigned int word_count;
+    unsigned int capacity;
+    std::vector<int32_t> wide_operands;
+
+    void reserve(unsigned int count);
+};
+
+/*
+    Why a script paused itself, see GssEngine::getWaitReason.
+*/
+enum class GssWaitReason
+{
+    none,
+    yield,  //Continue on the next tick.
+    time,   //wait(seconds)
+    event,  //wait_event(name)
+};
+
+/*
+    Compile time information on a script function.
+    Script function variants and the call_script instruction refer to functions by index in this table.
+*/
+class GssFunctionInfo
+{
+public:
+    string name;
+    unsigned int address;
+    unsigned int end_address; //First instruction after the function body.
+    unsigned int parameter_count;
+    unsigned int scratch_size;     //Bytes of scratch memory each call reserves for its push_scratch_list instructions.
+    uint32_t scratch_parameters;   //Bit per parameter that is never kept after the call returns, so a scratch list can be passed for it.
+
+    GssFunctionInfo(string name, unsigned int address, unsigned int parameter_count) : name(name), address(address), end_address(address), parameter_count(parameter_count), scratch_size(0), scratch_parameters(0) {}
+};
+
 #endif//GSS_INSTRUCTIONS_H
@@ -0,0 +1,704 @@
+#include "gss_jit.h"
+
+#include <string.h>
+#include <stddef.h>
+
+#ifdef GSS_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "gss_memory.h"
+#include "logging.h"
+
+#ifdef GSS_JIT_X86_64
+
+static constexpr unsigned int code_region_size = 4 * 1024 * 1024;
+
+static constexpr int RAX = 0;
+static constexpr int RCX = 1;
+static constexpr int RDX = 2;
+static constexpr int RBX = 3; //Tick budget.
+static constexpr int RSI = 6;
+static constexpr int RDI = 7;
+static constexpr int R12 = 12; //Locals of the current function.
+static constexpr int R13 = 13; //First free stack entry.
+static constexpr int R14 = 14; //End of the reserved stack.
+static constexpr int R15 = 15; //GssJitContext
+
+static constexpr uint8_t JUMP_ALWAYS = 0xff;
+static constexpr uint8_t CONDITION_AE = 0x3;
+static constexpr uint8_t CONDITION_E = 0x4;
+static constexpr uint8_t CONDITION_NE = 0x5;
+static constexpr uint8_t CONDITION_A = 0x7;
+static constexpr uint8_t CONDITION_P = 0xA;
+static constexpr uint8_t CONDITION_NP = 0xB;
+
+static constexpr uint8_t CONDITION_L = 0xC;
+static constexpr uint8_t CONDITION_GE = 0xD;
+static constexpr uint8_t CONDITION_LE = 0xE;
+static constexpr uint8_t CONDITION_G = 0xF;
+
+static constexpr int32_t VARIANT = sizeof(GssVariant);
+static constexpr uint64_t INTEGER_TAG = uint64_t(GssVariant::integer_tag) << 48;
+
+static_assert(sizeof(GssVariant) == 8, "Native code expects 8 byte NaN-boxed variants");
+
+GssJit::GssJit()
+: code(nullptr), code_size(0), code_used(0), exit_offset(0), trampoline_size(0)
+{
+    void* region = mmap(nullptr, code_region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+    {
+        LOG(WARNING) << "Failed to allocate memory for the JIT, scripts will only be interpreted.";
+        return;
+    }
+    code = (uint8_t*)region;
+    code_size = code_region_size;
+
+    //Entry trampoline: unsigned int entry(GssJitContext* context, const void* native_code)
+    buffer.clear();
+    buffer_address = 0;
+    emit(0x53);                     //push rbx
+    emit(0x41); emit(0x54);         //push r12
+    emit(0x41); emit(0x55);         //push r13
+    emit(0x41); emit(0x56);         //push r14
+    emit(0x41); emit(0x57);         //push r15
+    emitRegister(0, {0x89}, true, RDI, R15);                                    //mov r15, rdi
+    emitMemory(0, {0x8B}, true, R12, RDI, offsetof(GssJitContext, locals));     //mov r12, [rdi + locals]
+    emitMemory(0, {0x8B}, true, R13, RDI, offsetof(GssJitContext, stack_top));  //mov r13, [rdi + stack_top]
+    emitMemory(0, {0x8B}, true, R14, RDI, offsetof(GssJitContext, stack_end));  //mov r14, [rdi + stack_end]
+    emitMemory(0, {0x8B}, true, RBX, RDI, offsetof(GssJitContext, tick_budget)); //mov rbx, [rdi + tick_budget]
+    emit(0xFF); emit(0xE6);         //jmp rsi
+
+    //Common exit, eax holds the instruction pointer to continue at.
+    exit_offset = buffer.size();
+    emitMemory(0, {0x89}, true, R13, R15, offsetof(GssJitContext, stack_top)); //mov [r15 + stack_top], r13
+    emitMemory(0, {0x89}, true, RBX, R15, offsetof(GssJitContext, tick_budget)); //mov [r15 + tick_budget], rbx
+    emit(0x41); emit(0x5F);         //pop r15
+    emit(0x41); emit(0x5E);         //pop r14
+    emit(0x41); emit(0x5D);         //pop r13
+    emit(0x41); emit(0x5C);         //pop r12
+    emit(0x5B);                     //pop rbx
+    emit(0xC3);                     //ret
+
+    memcpy(code, buffer.data(), buffer.size());
+    trampoline_size = (buffer.size() + 15) & ~15;
+    code_used = trampoline_size;
+    setWritable(false);
+}
+
+void GssJit::reset()
+{
+    if (!code)
+        return;
+    code_used = trampoline_size;
+    //Give the pages of the dropped code back, they are mapped in again when new code is written to them.
+    unsigned int page_size = sysconf(_SC_PAGESIZE);
+    unsigned int first_free_page = (trampoline_size + page_size - 1) / page_size * page_size;
+    madvise(code + first_free_page, code_size - first_free_page, MADV_DONTNEED);
+}
+
+GssJit::~GssJit()
+{
+    if (code)
+        munmap(code, code_size);
+}
+
+bool GssJit::isSupported()
+{
+    return true;
+}
+
+bool GssJit::compile(const GssCode& instructions, const std::vector<double>& number_table, unsigned int start, unsigned int end, std::vector<const void*>& entry_points)
+{
+    if (!code)
+        return false;
+
+    buffer.clear();
+    fixups.clear();
+    buffer_address = code_used;
+
+    std::vector<unsigned int> instruction_offsets;
+    std::vector<bool> native;
+    for(unsigned int index=start; index<end; index++)
+    {
+        instruction_offsets.push_back(buffer.size());
+        native.push_back(emitInstruction(instructions.decode(index), number_table, index));
+        if (!native.back())
+            emitExit(index); //No native version of this instruction, let the interpreter handle it.
+    }
+    //Running past the end of the function body.
+    emitExit(end);
+
+    //Exit stubs for the guards and jumps outside of the function body, these are kept out of the normal code path.
+    std::vector<unsigned int> exit_stubs;
+    exit_stubs.resize(end - start + 1, 0);
+    for(Fixup& fixup : fixups)
+    {
+        if (!fixup.exit && fixup.target >= start && fixup.target < end)
+            continue;
+        if (fixup.target < start || fixup.target > end)
+        {
+            unsigned int position = buffer.size();
+            emitExit(fixup.target);
+            uint32_t offset = position - (fixup.position + 4);
+            memcpy(&buffer[fixup.position], &offset, 4);
+            fixup.position = 0;
+            continue;
+        }
+        unsigned int stub = fixup.target - start;
+        if (exit_stubs[stub] == 0)
+        {
+            exit_stubs[stub] = buffer.size();
+            emitExit(fixup.target);
+        }
+    }
+    for(Fixup& fixup : fixups)
+    {
+        if (fixup.position == 0)
+            continue;
+        unsigned int target_offset;
+        if (!fixup.exit && fixup.target >= start && fixup.target < end)
+            target_offset = instruction_offsets[fixup.target - start];
+        else
+            target_offset = exit_stubs[fixup.target - start];
+        uint32_t offset = target_offset - (fixup.position + 4);
+        memcpy(&buffer[fixup.position], &offset, 4);
+    }
+
+    if (code_used + buffer.size() > code_size)
+    {
+        LOG(WARNING) << "JIT code memory full, function stays interpreted.";
+        return false;
+    }
+    setWritable(true);
+    memcpy(code + code_used, buffer.data(), buffer.size());
+    setWritable(false);
+    for(unsigned int index=start; index<end; index++)
+    {
+        if (native[index - start])
+            entry_points[index] = code + code_used + instruction_offsets[index - start];
+    }
+    code_used = (code_used + buffer.size() + 15) & ~15;
+    return true;
+}
+
+unsigned int GssJit::execute(const void* entry_point, GssJitContext& context)
+{
+    typedef unsigned int (*TrampolineFunction)(GssJitContext* context, const void* entry_point);
+    return ((TrampolineFunction)code)(&context, entry_point);
+}
+
+bool GssJit::emitInstruction(const GssInstruction& instruction, const std::vector<double>& number_table, unsigned int index)
+{
+    GssVariant constant;
+    switch(instruction.type)
+    {
+    case GssInstruction::Type::nop:
+        return true;
+    case GssInstruction::Type::push_none:
+    case GssInstruction::Type::push_int:
+    case GssInstruction::Type::push_float:
+    case GssInstruction::Type::push_wide_int:
+        if (instruction.type == GssInstruction::Type::push_none)
+            constant.setNone();
+        else if (instruction.type == GssInstruction::Type::push_int)
+            constant.setInteger(instruction.data.i);
+        else if (instruction.type == GssInstruction::Type::push_wide_int)
+            constant.setInteger(int64_t(number_table[instruction.data.i]));
+        else
+            constant.setDouble(number_table[instruction.data.i]);
+        emitStackCheck(index);
+        emitMoveImmediate(RAX, constant.bits);
+        emitMemory(0, {0x89}, true, RAX, R13, 0);                              //mov [r13], rax
+        emitRegister(0, {0x81}, true, 0, R13); emit32(VARIANT);                 //add r13, sizeof(GssVariant)
+        return true;
+    case GssInstruction::Type::pop:
+        emitRegister(0, {0x81}, true, 5, R13); emit32(VARIANT);                 //sub r13, sizeof(GssVariant)
+        return true;
+    case GssInstruction::Type::iterator_start:
+        emitStackCheck(index);
+        emitMemory(0, {0x8B}, true, RAX, R13, -VARIANT);                       //mov rax, [top]
+        emitRegister(0, {0xC1}, true, 5, RAX); emit(32);                        //shr rax, 32
+        emitRegister(0, {0x81}, false, 7, RAX); emit32(GssVariant::list_tag << 16); //cmp eax, list tag without the array flag
+        emitJump(CONDITION_NE, index, true);
+        constant.setInteger(0);
+        emitMoveImmediate(RAX, constant.bits);
+        emitMemory(0, {0x89}, true, RAX, R13, 0);
+        emitRegister(0, {0x81}, true, 0, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::iterator_next:
+        emitStackCheck(index);
+        emitMemory(0, {0x8B}, false, RAX, R13, -2 * VARIANT);                  //mov eax, [list + reference]
+        emitMemory(0, {0x03}, true, RAX, R15, offsetof(GssJitContext, memory)); //add rax, [r15 + memory]
+        emitMemory(0, {0x8B}, false, RCX, R13, -VARIANT);                      //mov ecx, [index + value]
+        emitMemory(0, {0x3B}, false, RCX, RAX, offsetof(GssList, current_length)); //cmp ecx, [rax + current_length]
+        emitJump(CONDITION_AE, instruction.data.i, false);
+        emitMemory(0, {0x8B}, false, RDX, RAX, offsetof(GssList, position));   //mov edx, [rax + position]
+        emitMemory(0, {0x03}, true, RDX, R15, offsetof(GssJitContext, memory)); //add rdx, [r15 + memory]
+        emitRegister(0, {0xC1}, true, 4, RCX); emit(3);                         //shl rcx, 3
+        emitRegister(0, {0x01}, true, RCX, RDX);                                //add rdx, rcx
+        emitMemory(0, {0x8B}, true, RDX, RDX, 0);                              //mov rdx, [rdx]
+        emitMemory(0, {0x83}, false, 0, R13, -VARIANT); emit(1);                //add dword [index + value], 1
+        emitMemory(0, {0x89}, true, RDX, R13, 0);                              //mov [r13], rdx
+        emitRegister(0, {0x81}, true, 0, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::push_local_by_index:
+        emitStackCheck(index);
+        emitMemory(0, {0x8B}, true, RAX, R12, instruction.data.i * VARIANT);   //mov rax, [r12 + local]
+        emitMemory(0, {0x89}, true, RAX, R13, 0);                              //mov [r13], rax
+        emitRegister(0, {0x81}, true, 0, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::assign_local_by_index:
+        emitMemory(0, {0x8B}, true, RAX, R13, -VARIANT);                       //mov rax, [r13 - sizeof(GssVariant)]
+        emitMemory(0, {0x89}, true, RAX, R12, instruction.data.i * VARIANT);   //mov [r12 + local], rax
+        emitRegister(0, {0x81}, true, 5, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::push_global_by_index:
+        if (instruction.data.i > INT32_MAX / VARIANT)
+            return false;
+        emitStackCheck(index);
+        emitMemory(0, {0x8B}, true, RCX, R15, offsetof(GssJitContext, globals)); //mov rcx, [r15 + globals]
+        emitMemory(0, {0x8B}, true, RAX, RCX, instruction.data.i * VARIANT);   //mov rax, [rcx + global]
+        emitMemory(0, {0x89}, true, RAX, R13, 0);                              //mov [r13], rax
+        emitRegister(0, {0x81}, true, 0, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::assign_global_by_index:
+        if (instruction.data.i > INT32_MAX / VARIANT)
+            return false;
+        emitMemory(0, {0x8B}, true, RCX, R15, offsetof(GssJitContext, globals)); //mov rcx, [r15 + globals]
+        emitMemory(0, {0x8B}, true, RAX, R13, -VARIANT);                       //mov rax, [r13 - sizeof(GssVariant)]
+        emitMemory(0, {0x89}, true, RAX, RCX, instruction.data.i * VARIANT);   //mov [rcx + global], rax
+        emitRegister(0, {0x81}, true, 5, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::jump:
+        if (unsigned(instruction.data.i) <= index)
+            emitTick(index);
+        emitJump(JUMP_ALWAYS, instruction.data.i, false);
+        return true;
+    case GssInstruction::Type::jump_if_zero:
+    case GssInstruction::Type::jump_if_not_zero:
+        //Only integers, for other types the interpreter decides what is zero.
+        if (unsigned(instruction.data.i) <= index)
+            emitTick(index);
+        emitMemory(0, {0x8B}, true, RAX, R13, -VARIANT);                       //mov rax, [top]
+        emitTagCheck(RAX);
+        emitJump(CONDITION_NE, index, true);
+        emitRegister(0, {0x81}, true, 5, R13); emit32(VARIANT);
+        emitRegister(0, {0xC1}, true, 4, RAX); emit(16);                        //shl rax, 16, zero flag is set when the integer is zero
+        emitJump(instruction.type == GssInstruction::Type::jump_if_zero ? CONDITION_E : CONDITION_NE, instruction.data.i, false);
+        return true;
+    case GssInstruction::Type::boolean_not:
+        emitMemory(0, {0x8B}, true, RAX, R13, -VARIANT);
+        emitTagCheck(RAX);
+        emitJump(CONDITION_NE, index, true);
+        emitRegister(0, {0xC1}, true, 4, RAX); emit(16);                        //shl rax, 16
+        emit(0x0F); emit(0x90 | CONDITION_E); emit(0xC0);                      //sete al
+        emit(0x0F); emit(0xB6); emit(0xC0);                                    //movzx eax, al
+        emitStoreInteger(RAX, R13, -VARIANT);
+        return true;
+    case GssInstruction::Type::negative:
+        {
+            emitMemory(0, {0x8B}, true, RAX, R13, -VARIANT);
+            emitTagCheck(RAX);
+            unsigned int not_integer = emitForwardJump(CONDITION_NE);
+            emitSignExtend(RAX);
+            emitRegister(0, {0xF7}, true, 3, RAX);                              //neg rax
+            emitStoreInteger(RAX, R13, -VARIANT);
+            unsigned int done = emitForwardJump(JUMP_ALWAYS);
+            patchForwardJump(not_integer);
+            emitJump(CONDITION_A, index, true);                                 //Tags above integer are not numbers.
+            emitMemory(0, {0x0F, 0xBA}, true, 7, R13, -VARIANT); emit(63);      //btc qword [top], 63, flips the sign of the double
+            patchForwardJump(done);
+        }
+        return true;
+    case GssInstruction::Type::add:
+    case GssInstruction::Type::substract:
+    case GssInstruction::Type::multiply:
+    case GssInstruction::Type::division:
+    case GssInstruction::Type::modulo:
+    case GssInstruction::Type::binary_or:
+    case GssInstruction::Type::binary_not_2:
+    case GssInstruction::Type::binary_and:
+    case GssInstruction::Type::left_shift:
+    case GssInstruction::Type::right_shift:
+        emitArithmetic(instruction.type, R13, -2 * VARIANT, R13, -VARIANT, R13, -2 * VARIANT, index);
+        emitRegister(0, {0x81}, true, 5, R13); emit32(VARIANT);
+        return true;
+    case GssInstruction::Type::boolean_less:
+    case GssInstruction::Type::boolean_less_equal:
+    case GssInstruction::Type::boolean_greater:
+    case GssInstruction::Type::boolean_greater_equal:
+    case GssInstruction::Type::boolean_equal:
+    case GssInstruction::Type::boolean_not_equal:
+        emitComparison(instruction.type, R13, -2 * VARIANT, R13, -VARIANT, R13, -2 * VARIANT, index);
+        emitRegister(0, {0x81}, true, 5, R13); emit32(VARIANT);
+        return true;
+
+    case GssInstruction::Type::local_move:
+        emitMemory(0, {0x8B}, true, RAX, R12, instruction.getRegisterA() * VARIANT);
+        emitMemory(0, {0x89}, true, RAX, R12, instruction.getRegisterTarget() * VARIANT);
+        return true;
+    case GssInstruction::Type::local_load_int:
+        constant.setInteger(instruction.getRegisterImmediate());
+        emitMoveImmediate(RAX, constant.bits);
+        emitMemory(0, {0x89}, true, RAX, R12, instruction.getRegisterTarget() * VARIANT);
+        return true;
+    case GssInstruction::Type::local_add:
+    case GssInstruction::Type::local_substract:
+    case GssInstruction::Type::local_multiply:
+    case GssInstruction::Type::local_division:
+    case GssInstruction::Type::local_modulo:
+        emitArithmetic(GssInstruction::getStackOperation(instruction.type), R12, instruction.getRegisterA() * VARIANT, R12, instruction.getRegisterB() * VARIANT, R12, instruction.getRegisterTarget() * VARIANT, index);
+        return true;
+    case GssInstruction::Type::local_less:
+    case GssInstruction::Type::local_less_equal:
+    case GssInstruction::Type::local_greater:
+    case GssInstruction::Type::local_greater_equal:
+        emitComparison(GssInstruction::getStackOperation(instruction.type), R12, instruction.getRegisterA() * VARIANT, R12, instruction.getRegisterB() * VARIANT, R12, instruction.getRegisterTarget() * VARIANT, index);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void GssJit::emitTagCheck(int reg)
+{
+    emitRegister(0, {0x89}, true, reg, RDX);                        //mov rdx, reg
+    emitRegister(0, {0xC1}, true, 5, RDX); emit(48);                //shr rdx, 48
+    emitRegister(0, {0x81}, false, 7, RDX); emit32(GssVariant::integer_tag); //cmp edx, integer tag
+}
+
+void GssJit::emitSignExtend(int reg)
+{
+    emitRegister(0, {0xC1}, true, 4, reg); emit(16);                //shl reg, 16
+    emitRegister(0, {0xC1}, true, 7, reg); emit(16);                //sar reg, 16
+}
+
+void GssJit::emitStoreInteger(int reg, int base, int32_t offset)
+{
+    //Drop the top 16 bits, which wraps the integer around at 48 bits like GssVariant::setInteger.
+    emitRegister(0, {0xC1}, true, 4, reg); emit(16);                //shl reg, 16
+    emitRegister(0, {0xC1}, true, 5, reg); emit(16);                //shr reg, 16
+    emitMoveImmediate(RDX, INTEGER_TAG);
+    emitRegister(0, {0x09}, true, RDX, reg);                        //or reg, rdx
+    emitMemory(0, {0x89}, true, reg, base, offset);                 //mov [v], reg
+}
+
+void GssJit::emitToDouble(int xmm, int reg, unsigned int index)
+{
+    emitTagCheck(reg);
+    unsigned int integer = emitForwardJump(CONDITION_E);
+    emitJump(CONDITION_A, index, true);                             //Tags above integer are not numbers.
+    emitRegister(0x66, {0x0F, 0x6E}, true, xmm, reg);               //movq xmm, reg
+    unsigned int done = emitForwardJump(JUMP_ALWAYS);
+    patchForwardJump(integer);
+    emitSignExtend(reg);
+    emitRegister(0xF2, {0x0F, 0x2A}, true, xmm, reg);               //cvtsi2sd xmm, reg
+    patchForwardJump(done);
+}
+
+void GssJit::emitArithmetic(GssInstruction::Type operation, int base0, int32_t offset0, int base1, int32_t offset1, int target_base, int32_t target_offset, unsigned int index)
+{
+    //Both operands are read before the target is written, as the target can be one of the operands.
+    emitMemory(0, {0x8B}, true, RAX, base0, offset0);               //mov rax, [v0]
+    emitMemory(0, {0x8B}, true, RCX, base1, offset1);               //mov rcx, [v1]
+    emitTagCheck(RAX);
+    unsigned int float_path0 = emitForwardJump(CONDITION_NE);
+    emitTagCheck(RCX);
+    unsigned int float_path1 = emitForwardJump(CONDITION_NE);
+
+    //Integer path, on the sign extended 48 bit values.
+    emitSignExtend(RAX);
+    emitSignExtend(RCX);
+    switch(operation)
+    {
+    case GssInstruction::Type::add:
+        emitRegister(0, {0x01}, true, RCX, RAX);                    //add rax, rcx
+        break;
+    case GssInstruction::Type::substract:
+        emitRegister(0, {0x29}, true, RCX, RAX);                    //sub rax, rcx
+        break;
+    case GssInstruction::Type::multiply:
+        emitRegister(0, {0x0F, 0xAF}, true, RAX, RCX);              //imul rax, rcx
+        break;
+    case GssInstruction::Type::division:
+    case GssInstruction::Type::modulo:
+        //48 bit operands, so the 64 bit division cannot overflow.
+        emitRegister(0, {0x85}, true, RCX, RCX);                    //test rcx, rcx
+        emitJump(CONDITION_E, index, true);
+        emitRex(true, 0, 0); emit(0x99);                            //cqo
+        emitRegister(0, {0xF7}, true, 7, RCX);                      //idiv rcx
+        if (operation == GssInstruction::Type::modulo)
+            emitRegister(0, {0x89}, true, RDX, RAX);                //mov rax, rdx
+        break;
+    case GssInstruction::Type::binary_or:
+        emitRegister(0, {0x09}, true, RCX, RAX);                    //or rax, rcx
+        break;
+    case GssInstruction::Type::binary_not_2:
+        emitRegister(0, {0x31}, true, RCX, RAX);                    //xor rax, rcx
+        break;
+    case GssInstruction::Type::binary_and:
+        emitRegister(0, {0x21}, true, RCX, RAX);                    //and rax, rcx
+        break;
+    case GssInstruction::Type::left_shift:
+        emitRegister(0, {0xD3}, true, 4, RAX);                      //shl rax, cl
+        break;
+    case GssInstruction::Type::right_shift:
+        emitRegister(0, {0xD3}, true, 7, RAX);                      //sar rax, cl
+        break;
+    default:
+        break;
+    }
+    emitStoreInteger(RAX, target_base, target_offset);
+    unsigned int done = emitForwardJump(JUMP_ALWAYS);
+
+    //Double path, integers are converted like GssVariant::toDouble does.
+    patchForwardJump(float_path0);
+    patchForwardJump(float_path1);
+    if (operation != GssInstruction::Type::add && operation != GssInstruction::Type::substract && operation != GssInstruction::Type::multiply && operation != GssInstruction::Type::division)
+    {
+        //Float modulo and the integer only operations are left to the interpreter.
+        emitJump(JUMP_ALWAYS, index, true);
+    }else{
+        emitToDouble(0, RAX, index);
+        emitToDouble(1, RCX, index);
+        switch(operation)
+        {
+        case GssInstruction::Type::add:
+            emitRegister(0xF2, {0x0F, 0x58}, false, 0, 1);          //addsd xmm0, xmm1
+            break;
+        case GssInstruction::Type::substract:
+            emitRegister(0xF2, {0x0F, 0x5C}, false, 0, 1);          //subsd xmm0, xmm1
+            break;
+        case GssInstruction::Type::multiply:
+            emitRegister(0xF2, {0x0F, 0x59}, false, 0, 1);          //mulsd xmm0, xmm1
+            break;
+        case GssInstruction::Type::division:
+            emitRegister(0xF2, {0x0F, 0x5E}, false, 0, 1);          //divsd xmm0, xmm1
+            break;
+        default:
+            break;
+        }
+        //Operations on canonical NaNs give canonical NaNs, so the result never looks like a tagged value.
+        emitMemory(0xF2, {0x0F, 0x11}, false, 0, target_base, target_offset);   //movsd [target], xmm0
+    }
+    patchForwardJump(done);
+}
+
+void GssJit::emitComparison(GssInstruction::Type operation, int base0, int32_t offset0, int base1, int32_t offset1, int target_base, int32_t target_offset, unsigned int index)
+{
+    emitMemory(0, {0x8B}, true, RAX, base0, offset0);
+    emitMemory(0, {0x8B}, true, RCX, base1, offset1);
+    emitTagCheck(RAX);
+    unsigned int float_path0 = emitForwardJump(CONDITION_NE);
+    emitTagCheck(RCX);
+    unsigned int float_path1 = emitForwardJump(CONDITION_NE);
+
+    emitSignExtend(RAX);
+    emitSignExtend(RCX);
+    emitRegister(0, {0x39}, true, RCX, RAX);                        //cmp rax, rcx
+    uint8_t condition = CONDITION_L;
+    switch(operation)
+    {
+    case GssInstruction::Type::boolean_less: condition = CONDITION_L; break;
+    case GssInstruction::Type::boolean_less_equal: condition = CONDITION_LE; break;
+    case GssInstruction::Type::boolean_greater: condition = CONDITION_G; break;
+    case GssInstruction::Type::boolean_greater_equal: condition = CONDITION_GE; break;
+    case GssInstruction::Type::boolean_equal: condition = CONDITION_E; break;
+    case GssInstruction::Type::boolean_not_equal: condition = CONDITION_NE; break;
+    default: break;
+    }
+    emit(0x0F); emit(0x90 | condition); emit(0xC0);                 //setcc al
+    unsigned int done = emitForwardJump(JUMP_ALWAYS);
+
+    patchForwardJump(float_path0);
+    patchForwardJump(float_path1);
+    emitToDouble(0, RAX, index);
+    emitToDouble(1, RCX, index);
+    //comisd sets the carry and zero flag on unordered (NaN), so seta/setae give false on NaN just like the C++ comparison.
+    switch(operation)
+    {
+    case GssInstruction::Type::boolean_less:
+        emitRegister(0x66, {0x0F, 0x2F}, false, 1, 0);              //comisd xmm1, xmm0
+        emit(0x0F); emit(0x90 | CONDITION_A); emit(0xC0);           //seta al
+        break;
+    case GssInstruction::Type::boolean_less_equal:
+        emitRegister(0x66, {0x0F, 0x2F}, false, 1, 0);              //comisd xmm1, xmm0
+        emit(0x0F); emit(0x90 | CONDITION_AE); emit(0xC0);          //setae al
+        break;
+    case GssInstruction::Type::boolean_greater:
+        emitRegister(0x66, {0x0F, 0x2F}, false, 0, 1);              //comisd xmm0, xmm1
+        emit(0x0F); emit(0x90 | CONDITION_A); emit(0xC0);           //seta al
+        break;
+    case GssInstruction::Type::boolean_greater_equal:
+        emitRegister(0x66, {0x0F, 0x2F}, false, 0, 1);              //comisd xmm0, xmm1
+        emit(0x0F); emit(0x90 | CONDITION_AE); emit(0xC0);          //setae al
+        break;
+    //Unordered sets the parity flag, NaN is not equal to anything.
+    case GssInstruction::Type::boolean_equal:
+        emitRegister(0x66, {0x0F, 0x2E}, false, 0, 1);              //ucomisd xmm0, xmm1
+        emit(0x0F); emit(0x90 | CONDITION_E); emit(0xC0);           //sete al
+        emit(0x0F); emit(0x90 | CONDITION_NP); emit(0xC1);          //setnp cl
+        emit(0x20); emit(0xC8);                                     //and al, cl
+        break;
+    case GssInstruction::Type::boolean_not_equal:
+        emitRegister(0x66, {0x0F, 0x2E}, false, 0, 1);              //ucomisd xmm0, xmm1
+        emit(0x0F); emit(0x90 | CONDITION_NE); emit(0xC0);          //setne al
+        emit(0x0F); emit(0x90 | CONDITION_P); emit(0xC1);           //setp cl
+        emit(0x08); emit(0xC8);                                     //or al, cl
+        break;
+    default:
+        break;
+    }
+    patchForwardJump(done);
+    emit(0x0F); emit(0xB6); emit(0xC0);                             //movzx eax, al
+    emitStoreInteger(RAX, target_base, target_offset);
+}
+
+void GssJit::emitMoveImmediate(int reg, uint64_t value)
+{
+    emitRex(true, 0, reg);
+    emit(0xB8 | (reg & 7));                                         //mov reg, imm64
+    emit32(value);
+    emit32(value >> 32);
+}
+
+void GssJit::emitExit(unsigned int index)
+{
+    emit(0xB8); emit32(index);                                      //mov eax, index
+    emit(0xE9); emit32(exit_offset - (buffer_address + buffer.size() + 4));
+}
+
+void GssJit::emitStackCheck(unsigned int index)
+{
+    //Growing the stack needs an allocation, leave that to the interpreter.
+    emitRegister(0, {0x39}, true, R14, R13);                        //cmp r13, r14
+    emitJump(CONDITION_AE, index, true);
+}
+
+void GssJit::emitTick(unsigned int index)
+{
+    //The last tick of the budget is left to the interpreter, which runs the jump again and then checks the limits.
+    emitRegister(0, {0x83}, true, 7, RBX); emit(1);                  //cmp rbx, 1
+    emitJump(CONDITION_LE, index, true);
+    emitRegister(0, {0x83}, true, 5, RBX); emit(1);                  //sub rbx, 1
+}
+
+void GssJit::emit(uint8_t value)
+{
+    buffer.push_back(value);
+}
+
+void GssJit::emit32(uint32_t value)
+{
+    emit(value);
+    emit(value >> 8);
+    emit(value >> 16);
+    emit(value >> 24);
+}
+
+void GssJit::emitRex(bool wide, int reg, int base)
+{
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (rex != 0x40)
+        emit(rex);
+}
+
+void GssJit::emitMemory(uint8_t prefix, std::initializer_list<uint8_t> opcode, bool wide, int reg, int base, int32_t offset)
+{
+    if (prefix)
+        emit(prefix);
+    emitRex(wide, reg, base);
+    for(uint8_t value : opcode)
+        emit(value);
+    //Always use an explicit displacement, this avoids the special cases for rbp and r13 as base.
+    bool small = offset >= -128 && offset <= 127;
+    emit((small ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == 4)
+        emit(0x24); //SIB byte needed for rsp and r12 as base.
+    if (small)
+        emit(offset);
+    else
+        emit32(offset);
+}
+
+void GssJit::emitRegister(uint8_t prefix, std::initializer_list<uint8_t> opcode, bool wide, int reg, int rm)
+{
+    if (prefix)
+        emit(prefix);
+    emitRex(wide, reg, rm);
+    for(uint8_t value : opcode)
+        emit(value);
+    emit(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void GssJit::emitJump(uint8_t condition, unsigned int target, bool exit)
+{
+    if (condition == JUMP_ALWAYS)
+    {
+        emit(0xE9);
+    }else{
+        emit(0x0F);
+        emit(0x80 | condition);
+    }
+    fixups.push_back({(unsigned int)buffer.size(), target, exit});
+    emit32(0);
+}
+
+unsigned int GssJit::emitForwardJump(uint8_t condition)
+{
+    if (condition == JUMP_ALWAYS)
+    {
+        emit(0xE9);
+    }else{
+        emit(0x0F);
+        emit(0x80 | condition);
+    }
+    emit32(0);
+    return buffer.size() - 4;
+}
+
+void GssJit::patchForwardJump(unsigned int position)
+{
+    uint32_t offset = buffer.size() - (position + 4);
+    memcpy(&buffer[position], &offset, 4);
+}
+
+void GssJit::setWritable(bool writable)
+{
+    mprotect(code, code_size, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+}
+
+#else//GSS_JIT_X86_64
+
+GssJit::GssJit()
+: code(nullptr), code_size(0), code_used(0), exit_offset(0), trampoline_size(0)
+{
+}
+
+GssJit::~GssJit()
+{
+}
+
+bool GssJit::isSupported()
+{
+    return false;
+}
+
+bool GssJit::compile(const GssCode& instructions, const std::vector<double>& number_table, unsigned int start, unsigned int end, std::vector<const void*>& entry_points)
+{
+    return false;
+}
+
+void GssJit::reset()
+{
+}
+
+unsigned int GssJit::execute(const void* entry_point, GssJitContext& context)
+{
+    return 0;
+}
+
+#endif//GSS_JIT_X86_64
@@ -0,0 +1,100 @@
+#ifndef GSS_JIT_H
+#define GSS_JIT_H
+
+#include <SFML/System.hpp>
+#include <stdint.h>
+#include <vector>
+#include <initializer_list>
+
+#include "gss_instructions.h"
+#include "gss_variant.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define GSS_JIT_X86_64 1
+#endif
+
+/*
+    State shared between the engine and native code while native code runs.
+    The locals and stack pointers are only valid as long as no allocation happens,
+    which is why native code never allocates memory.
+*/
+class GssJitContext
+{
+public:
+    GssVariant* locals;
+    GssVariant* stack_top;  //First free stack entry, updated when native code exits.
+    GssVariant* stack_end;  //End of the reserved stack space.
+    uint8_t* memory;        //Start of the GssMemory block, that memory positions are relative to.
+    GssVariant* globals;    //Fixed array of the globals, outside of the GssMemory block.
+    int64_t tick_budget;    //Counted down on backward jumps, native code exits when it runs out so the interpreter can check the limits.
+};
+
+/*
+    The GssJit is a simple template JIT. It translates script function bodies instruction by
+    instruction into x86-64 code. The native code works on the same stack and locals in GssMemory
+    as the interpreter does, so every instruction boundary is a valid point to go back to the interpreter.
+
+    Native code only handles the fast paths (numbers, locals, globals and jumps). Anything else, including
+    type mismatches, exits the native code with the instruction pointer of the instruction that
+    the interpreter needs to execute next.
+
+    Only available on Linux x86-64, on other platforms compile() does nothing.
+*/
+class GssJit : sf::NonCopyable
+{
+public:
+    GssJit();
+    ~GssJit();
+
+    static bool isSupported();
+
+    //Translate the instructions [start, end) into native code. entry_points gets the native entry for each instruction that has one.
+    bool compile(const GssCode& instructions, const std::vector<double>& number_table, unsigned int start, unsigned int end, std::vector<const void*>& entry_points);
+    //Drop the native code of all compiled functions, so the code space can be used again. All entry points become invalid.
+    void reset();
+    //Run native code starting at the entry point, returns the instruction pointer at which the interpreter needs to continue.
+    unsigned int execute(const void* entry_point, GssJitContext& context);
+private:
+    uint8_t* code;
+    unsigned int code_size;
+    unsigned int code_used;
+    unsigned int exit_offset;
+    unsigned int trampoline_size; //Start of the function code, after the entry trampoline and the common exit.
+
+    std::vector<uint8_t> buffer;
+    unsigned int buffer_address; //Offset in [code] where [buffer] will be placed.
+
+    class Fixup
+    {
+    public:
+        unsigned int position;  //Position of the rel32 in [buffer].
+        unsigned int target;    //Instruction index to jump to.
+        bool exit;              //Jump to the exit stub of the target instead of the native code of the target.
+    };
+    std::vector<Fixup> fixups;
+
+    void emit(uint8_t value);
+    void emit32(uint32_t value);
+    void emitRex(bool wide, int reg, int base);
+    void emitMemory(uint8_t prefix, std::initializer_list<uint8_t> opcode, bool wide, int reg, int base, int32_t offset);
+    void emitRegister(uint8_t prefix, std::initializer_list<uint8_t> opcode, bool wide, int reg, int rm);
+    void emitJump(uint8_t condition, unsigned int target, bool exit);
+    unsigned int emitForwardJump(uint8_t condition);
+    void patchForwardJump(unsigned int position);
+
+    bool emitInstruction(const GssInstruction& instruction, const std::vector<double>& number_table, unsigned int index);
+    void emitExit(unsigned int index);
+    void emitMoveImmediate(int reg, uint64_t value);
+    void emitTagCheck(int reg); //Compares the tag of the variant in [reg] with the integer tag: equal for integers, below for doubles.
+    void emitSignExtend(int reg);
+    void emitStoreInteger(int reg, int base, int32_t offset);
+    void emitToDouble(int xmm, int reg, unsigned int index);
+    void emitArithmetic(GssInstruction::Type operation, int base0, int32_t offset0, int base1, int32_t offset1, int target_base, int32_t target_offset, unsigned int index);
+    void emitComparison(GssInstruction::Type operation, int base0, int32_t offset0, int base1, int32_t offset1, int target_base, int32_t target_offset, unsigned int index);
+    void emitStackCheck(unsigned int index);
+    void emitTick(unsigned int index); //For backward jumps, exits to the jump at [index] when the tick budget runs out.
+
+    void setWritable(bool writable);
+};
+
+#endif//GSS_JIT_H
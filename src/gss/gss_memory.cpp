@@ -1,24 +1,69 @@
 #include "gss_memory.h"
 #include "gss_garbage_collector.h"
+#include "gss_snapshot.h"
 
 #include <string.h>
+#include <algorithm>
+#include <chrono>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "logging.h"
 
 GssMemory::GssMemory(unsigned int size)
 {
     memory = calloc(size, 1);
+    spare_memory = nullptr;
     memory_size = size;
+    memory_mapped = false;
     
     allocation_point = 0;
+    scratch_point = size;
+    scratch_clear_point = size;
+    heap_limit = size;
     
     stack_location = createList(32);
-    globals_location = createList(32);
+}
+
+GssMemory::GssMemory(std::shared_ptr<GssMemoryImage> image)
+{
+    memory = nullptr;
+    memory_size = image->memory_size;
+    memory_mapped = false;
+#ifdef __linux__
+    if (image->fd > -1)
+    {
+        memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->fd, 0);
+        if (memory == MAP_FAILED)
+            memory = nullptr;
+        else
+            memory_mapped = true;
+    }
+#endif
+    if (!memory)
+    {
+        memory = calloc(memory_size, 1);
+        memcpy(memory, image->data, image->allocation_point);
+        memcpy(get(image->scratch_point), ((char*)image->data) + image->allocation_point, memory_size - image->scratch_point);
+    }
+    spare_memory = nullptr;
+
+    stack_location = image->stack_location;
+    globals = image->globals;
+    allocation_point = image->allocation_point;
+    scratch_point = image->scratch_point;
+    scratch_clear_point = image->scratch_point;
+    scratch_lists = image->scratch_lists;
+    heap_limit = memory_size;
+    shapes = image->shapes;
 }
 
 GssMemory::~GssMemory()
 {
-    free(memory);
+    freeMemoryBuffer();
+    free(spare_memory);
 }
 
 GssVariant* GssMemory::appendStack()
@@ -73,31 +118,16 @@ unsigned int GssMemory::getStackSize()
     return list->current_length;
 }
 
-GssVariant* GssMemory::getGlobal(unsigned int index)
+GssList* GssMemory::getStackList()
 {
-    GssList* list = (GssList*)get(globals_location);
-    if (list->reserved_length <= index)
-    {
-        unsigned int new_reserved_length = index + 1;
-        unsigned int new_list_location = allocate(sizeof(GssVariant) * new_reserved_length);
-        // list variable is now invalid, as allocate could have moved the [stack_location]
-        GssList* list = (GssList*)get(globals_location);
-        for(unsigned int n=0; n<list->current_length; n++)
-        {
-            GssVariant* old_var = (GssVariant*)get(list->position + sizeof(GssVariant) * n);
-            GssVariant* new_var = (GssVariant*)get(new_list_location + sizeof(GssVariant) * n);
-            *new_var = *old_var;
-        }
-        list->reserved_length = new_reserved_length;
-        list->position = new_list_location;
-    }
-    while(list->current_length <= index)
-    {
-        GssVariant* var = (GssVariant*)get(list->position + sizeof(GssVariant) * list->current_length);
-        var->type = GssVariant::Type::none;
-        list->current_length += 1;
-    }
-    return (GssVariant*)get(list->position + sizeof(GssVariant) * index);
+    return (GssList*)get(stack_location);
+}
+
+void GssMemory::setGlobalCount(unsigned int count)
+{
+    GssVariant none;
+    none.setNone();
+    globals.resize(count, none);
 }
 
 unsigned int GssMemory::createString(const string& str)
@@ -119,20 +149,21 @@ string GssMemory::getString(unsigned int position)
 
 unsigned int GssMemory::createList(unsigned int reserved_length)
 {
-    unsigned int location = allocate(sizeof(GssList));
+    //A single allocation for the list and its entries: a GC between two allocations would move the list before anything refers to it.
+    unsigned int location = allocate(sizeof(GssList) + sizeof(GssVariant) * reserved_length);
     GssList* list = (GssList*)get(location);
     list->current_length = 0;
     list->reserved_length = reserved_length;
-    list->position = allocate(sizeof(GssVariant) * reserved_length);
+    list->position = location + sizeof(GssList);
     return location;
 }
 
 GssVariant* GssMemory::appendListOnStack()
 {
     GssVariant* list_v = getStack(-1);
-    if (list_v->type != GssVariant::Type::list)
+    if (!list_v->is(GssVariant::Type::list))
         throw GssMemoryException("Tried to append on non-list item: " + list_v->toString());
-    GssList* list = (GssList*)get(list_v->data.i);
+    GssList* list = (GssList*)get(list_v->getReference());
     if (list->current_length < list->reserved_length)
     {
         list->current_length++;
@@ -144,12 +175,12 @@ GssVariant* GssMemory::appendListOnStack()
     int new_buffer_position = allocate(sizeof(GssVariant) * list->reserved_length);
     //After this allocate all previous pointers are invalid, as GC could have happened.
     list_v = getStack(-1);
-    list = (GssList*)get(list_v->data.i);
+    list = (GssList*)get(list_v->getReference());
     GssVariant* old_ptr = (GssVariant*)get(list->position);
     GssVariant* new_ptr = (GssVariant*)get(new_buffer_position);
     for(unsigned int n=0; n<list->current_length; n++)
     {
-        *(old_ptr + n) = *(old_ptr + n);
+        *(new_ptr + n) = *(old_ptr + n);
     }
     list->current_length++;
     list->position = new_buffer_position;
@@ -166,32 +197,303 @@ GssVariant* GssMemory::getListEntry(unsigned int list_memory_position, int list_
     return ((GssVariant*)get(list->position)) + list_entry;
 }
 
+GssVariant* GssMemory::getListEntries(const GssList* list)
+{
+    return (GssVariant*)get(list->position);
+}
+
+unsigned int GssMemory::createDictionary(unsigned int reserved_length)
+{
+    //A single allocation, like createList.
+    unsigned int location = allocate(sizeof(GssDictionary) + sizeof(GssVariant) * reserved_length);
+    GssDictionary* dictionary = getDictionary(location);
+    dictionary->shape = GssShapeTable::empty_shape;
+    dictionary->reserved_length = reserved_length;
+    dictionary->position = location + sizeof(GssDictionary);
+    return location;
+}
+
+unsigned int GssMemory::createArray(GssArray::ElementType element_type, unsigned int length)
+{
+    if (length > (memory_size - sizeof(GssArray)) / sizeof(uint32_t))
+        throw GssMemoryException("Out of memory");
+    unsigned int location = allocate(GssArray::getSize(length));
+    GssArray* array = getArray(location);
+    array->element_type = element_type;
+    array->length = length;
+    memset(array + 1, 0, sizeof(uint32_t) * length);
+    return location;
+}
+
+unsigned int GssMemory::createVec2(double x, double y)
+{
+    unsigned int location = allocate(sizeof(GssVec2));
+    GssVec2* vec2 = (GssVec2*)get(location);
+    vec2->x = x;
+    vec2->y = y;
+    return location;
+}
+
+unsigned int GssMemory::reserveScratch(unsigned int size)
+{
+    if (size == 0)
+        return scratch_point;
+    size = ((size - 1) | 0x3) + 1;
+    if (!hasRoom(size))
+        makeRoom(size);
+    scratch_point -= size;
+    //Cleared, as createScratchList uses the list position to see if the list is known to the GC already.
+    memset(get(scratch_point), 0, size);
+    scratch_clear_point = std::min(scratch_clear_point, scratch_point);
+    return scratch_point;
+}
+
+void GssMemory::releaseScratch(unsigned int new_scratch_point)
+{
+    scratch_point = new_scratch_point;
+    while(!scratch_lists.empty() && scratch_lists.back() < scratch_point)
+        scratch_lists.pop_back();
+}
+
+unsigned int GssMemory::createScratchList(unsigned int position, unsigned int length)
+{
+    GssList* list = getList(position);
+    //A literal in a loop gets the same position each time, only the first one in a call is new to the GC.
+    if (list->position == 0)
+        scratch_lists.push_back(position);
+    list->current_length = 0;
+    list->reserved_length = length;
+    list->position = position + sizeof(GssList);
+    return position;
+}
+
+GssVariant* GssMemory::getDictionaryEntry(unsigned int dictionary_memory_position, uint32_t slot)
+{
+    return ((GssVariant*)get(getDictionary(dictionary_memory_position)->position)) + slot;
+}
+
+void GssMemory::addDictionarySlotOnStack(int position, uint32_t new_shape)
+{
+    uint32_t slot_count = shapes.getSlotCount(new_shape);
+    GssDictionary* dictionary = getDictionary(getStack(position)->getReference());
+    if (slot_count > dictionary->reserved_length)
+    {
+        unsigned int new_reserved_length = dictionary->reserved_length + 4;
+        unsigned int new_values_location = allocate(sizeof(GssVariant) * new_reserved_length);
+        //After this allocate all previous pointers are invalid, as GC could have happened.
+        dictionary = getDictionary(getStack(position)->getReference());
+        memcpy(get(new_values_location), get(dictionary->position), sizeof(GssVariant) * (slot_count - 1));
+        dictionary->reserved_length = new_reserved_length;
+        dictionary->position = new_values_location;
+    }
+    dictionary->shape = new_shape;
+    getDictionaryEntry(getStack(position)->getReference(), slot_count - 1)->setNone();
+}
+
+void GssMemory::setHeapLimit(unsigned int size)
+{
+    heap_limit = size ? std::min(size, memory_size) : memory_size;
+}
+
 unsigned int GssMemory::getFreeMemoryAmount()
 {
     runGarbageCollect();
-    return memory_size - allocation_point;
+    unsigned int used = allocation_point + (memory_size - scratch_point);
+    return used < heap_limit ? heap_limit - used : 0;
 }
 
-unsigned int GssMemory::allocate(unsigned int size)
+GssMemoryStatistics GssMemory::getStatistics()
 {
-    size = ((size - 1) | 0x3) + 1;
-    if (memory_size - allocation_point < size)
+    GssMemoryStatistics result = statistics;
+    result.peak_heap_size = std::max(result.peak_heap_size, allocation_point);
+    return result;
+}
+
+void GssMemory::writeSnapshot(GssSnapshotWriter& writer)
+{
+    runGarbageCollect();
+    writer.writeUInt32(memory_size);
+    writer.writeUInt32(stack_location);
+    writer.writeUInt32(allocation_point);
+    shapes.writeSnapshot(writer);
+    writer.writeBytes(memory, allocation_point);
+    writer.writeUInt32(scratch_point);
+    writer.writeUInt32(scratch_lists.size());
+    for(unsigned int position : scratch_lists)
+        writer.writeUInt32(position);
+    writer.writeBytes(get(scratch_point), memory_size - scratch_point);
+    writer.writeUInt32(globals.size());
+    writer.writeBytes(globals.data(), sizeof(GssVariant) * globals.size());
+}
+
+std::unique_ptr<GssMemorySnapshot> GssMemory::readSnapshot(GssSnapshotReader& reader)
+{
+    std::unique_ptr<GssMemorySnapshot> snapshot(new GssMemorySnapshot());
+    snapshot->memory_size = reader.readUInt32();
+    snapshot->stack_location = reader.readUInt32();
+    snapshot->allocation_point = reader.readUInt32();
+    if (snapshot->allocation_point > snapshot->memory_size || snapshot->stack_location >= snapshot->allocation_point)
+        throw GssSnapshotException("Snapshot memory image is corrupt");
+    snapshot->shapes.readSnapshot(reader);
+    //The spare buffer of the GC is zero filled as well, take it when the size matches instead of allocating a new one.
+    if (snapshot->memory_size == memory_size && spare_memory)
     {
-        runGarbageCollect();
+        snapshot->buffer = spare_memory;
+        spare_memory = nullptr;
+    }else{
+        snapshot->buffer = calloc(snapshot->memory_size, 1);
+        if (!snapshot->buffer)
+            throw GssSnapshotException("Out of memory for the snapshot memory image");
     }
-    if (memory_size - allocation_point < size)
+    reader.readBytes(snapshot->buffer, snapshot->allocation_point);
+    snapshot->scratch_point = reader.readUInt32();
+    if (snapshot->scratch_point < snapshot->allocation_point || snapshot->scratch_point > snapshot->memory_size)
+        throw GssSnapshotException("Snapshot memory image is corrupt");
+    snapshot->scratch_lists.resize(reader.readUInt32());
+    for(unsigned int& position : snapshot->scratch_lists)
     {
-        throw GssMemoryException("Out of memory");
+        position = reader.readUInt32();
+        if (position < snapshot->scratch_point || position + sizeof(GssList) > snapshot->memory_size)
+            throw GssSnapshotException("Snapshot memory image is corrupt");
+    }
+    reader.readBytes(((char*)snapshot->buffer) + snapshot->scratch_point, snapshot->memory_size - snapshot->scratch_point);
+    snapshot->globals.resize(reader.readUInt32());
+    reader.readBytes(snapshot->globals.data(), sizeof(GssVariant) * snapshot->globals.size());
+    return snapshot;
+}
+
+void GssMemory::applySnapshot(std::unique_ptr<GssMemorySnapshot> snapshot)
+{
+    if (snapshot->memory_size == memory_size)
+    {
+        //The old buffer becomes the spare buffer, like after a GC.
+        recycleBuffer(memory, allocation_point);
+    }else{
+        freeMemoryBuffer();
+        free(spare_memory);
+        spare_memory = nullptr;
+        memory_mapped = false;
+        heap_limit = heap_limit < memory_size ? std::min(heap_limit, snapshot->memory_size) : snapshot->memory_size;
+        memory_size = snapshot->memory_size;
+    }
+    memory = snapshot->buffer;
+    snapshot->buffer = nullptr;
+    stack_location = snapshot->stack_location;
+    allocation_point = snapshot->allocation_point;
+    scratch_point = snapshot->scratch_point;
+    scratch_clear_point = snapshot->scratch_point;
+    scratch_lists = std::move(snapshot->scratch_lists);
+    globals = std::move(snapshot->globals);
+    shapes = std::move(snapshot->shapes);
+}
+
+GssMemorySnapshot::~GssMemorySnapshot()
+{
+    free(buffer);
+}
+
+std::shared_ptr<GssMemoryImage> GssMemory::createImage()
+{
+    runGarbageCollect();
+    std::shared_ptr<GssMemoryImage> image(new GssMemoryImage());
+    image->memory_size = memory_size;
+    image->stack_location = stack_location;
+    image->globals = globals;
+    image->allocation_point = allocation_point;
+    image->scratch_point = scratch_point;
+    image->scratch_lists = scratch_lists;
+    image->shapes = shapes;
+    unsigned int scratch_size = memory_size - scratch_point;
+#ifdef __linux__
+    image->fd = memfd_create("gss_memory_image", MFD_CLOEXEC);
+    if (image->fd > -1)
+    {
+        if (ftruncate(image->fd, memory_size) == 0 && pwrite(image->fd, memory, allocation_point, 0) == ssize_t(allocation_point)
+            && pwrite(image->fd, get(scratch_point), scratch_size, scratch_point) == ssize_t(scratch_size))
+            return image;
+        close(image->fd);
+        image->fd = -1;
     }
+#endif
+    image->data = malloc(allocation_point + scratch_size);
+    memcpy(image->data, memory, allocation_point);
+    memcpy(((char*)image->data) + allocation_point, get(scratch_point), scratch_size);
+    return image;
+}
+
+GssMemoryImage::~GssMemoryImage()
+{
+#ifdef __linux__
+    if (fd > -1)
+        close(fd);
+#endif
+    free(data);
+}
+
+unsigned int GssMemory::allocate(unsigned int size)
+{
+    size = ((size - 1) | 0x3) + 1;
+    if (!hasRoom(size))
+        makeRoom(size);
     unsigned int result = allocation_point;
     allocation_point += size;
     return result;
 }
 
+void GssMemory::makeRoom(unsigned int size)
+{
+    runGarbageCollect();
+    if (hasRoom(size))
+        return;
+    if (scratch_point - allocation_point >= size)
+        throw GssMemoryException("Heap limit of " + string(heap_limit) + " bytes exceeded", true);
+    throw GssMemoryException("Out of memory");
+}
+
+void GssMemory::recycleBuffer(void* buffer, unsigned int used_size)
+{
+    //The GC copied only the reserved scratch room into the new buffer.
+    unsigned int old_scratch_clear_point = scratch_clear_point;
+    scratch_clear_point = scratch_point;
+#ifdef __linux__
+    if (memory_mapped)
+    {
+        //Clearing the mapped image would copy all its pages, so get a fresh buffer instead.
+        munmap(buffer, memory_size);
+        memory_mapped = false;
+        spare_memory = nullptr;
+        return;
+    }
+#endif
+    //Only the part up to the allocation point was ever written, clear that so the buffer is zero filled again.
+    memset(buffer, 0, used_size);
+    memset(((char*)buffer) + old_scratch_clear_point, 0, memory_size - old_scratch_clear_point);
+    spare_memory = buffer;
+}
+
+void GssMemory::freeMemoryBuffer()
+{
+#ifdef __linux__
+    if (memory_mapped)
+    {
+        munmap(memory, memory_size);
+        return;
+    }
+#endif
+    free(memory);
+}
+
 void GssMemory::runGarbageCollect()
 {
     //LOG(DEBUG) << "runGarbageCollect pre: " << (memory_size - allocation_point);
+    auto start = std::chrono::steady_clock::now();
+    statistics.peak_heap_size = std::max(statistics.peak_heap_size, allocation_point);
     GssGarbageCollector garbage_collector(this);
     garbage_collector.run();
+    uint64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    statistics.garbage_collect_count++;
+    statistics.garbage_collect_time_ns += pause;
+    statistics.garbage_collect_max_pause_ns = std::max(statistics.garbage_collect_max_pause_ns, pause);
+    statistics.peak_live_size = std::max(statistics.peak_live_size, allocation_point);
     //LOG(DEBUG) << "runGarbageCollect post:" << (memory_size - allocation_point);
 }
@@ -3,15 +3,69 @@
 
 #include <SFML/System.hpp>
 #include <limits>
+#include <memory>
 
 #include "gss_variant.h"
+#include "gss_shape.h"
 
+/*
+    Counters of a GssMemory, for benchmarks and for tuning the memory size.
+*/
+class GssMemoryStatistics
+{
+public:
+    unsigned int garbage_collect_count;
+    uint64_t garbage_collect_time_ns;      //Total time spent in the GC.
+    uint64_t garbage_collect_max_pause_ns; //Longest single GC run.
+    unsigned int peak_heap_size;           //Most bytes in use at any time, including garbage that was not collected yet.
+    unsigned int peak_live_size;           //Most bytes left in use after a GC.
+
+    GssMemoryStatistics() : garbage_collect_count(0), garbage_collect_time_ns(0), garbage_collect_max_pause_ns(0), peak_heap_size(0), peak_live_size(0) {}
+};
+
+/*
+    Packed 32 bit numbers, for bulk math with the GssArrayFunctions. The elements directly follow the header.
+*/
+class GssArray
+{
+public:
+    enum class ElementType : uint32_t
+    {
+        float32,
+        int32
+    };
+
+    ElementType element_type;
+    uint32_t length;
+
+    float* getFloats() { return (float*)(this + 1); }
+    int32_t* getInts() { return (int32_t*)(this + 1); }
+    static unsigned int getSize(unsigned int length) { return sizeof(GssArray) + sizeof(uint32_t) * length; } //Both element types are 4 bytes.
+    //Conversion of other numbers for int32 arrays: truncates, and saturates outside of the int32 range.
+    static int32_t toInt32(double value) { if (value != value) return 0; return int32_t(std::max(-2147483648.0, std::min(2147483647.0, value))); }
+};
+
+//Value of a vec2, never changed after creation, so the same one can be referenced from many places.
+class GssVec2
+{
+public:
+    double x;
+    double y;
+};
+
+class GssList;
+class GssDictionary;
+class GssSnapshotWriter;
+class GssSnapshotReader;
+class GssMemoryImage;
+class GssMemorySnapshot;
 class GssMemory : sf::NonCopyable
 {
 public:
     static constexpr unsigned int NO_MEMORY = std::numeric_limits<unsigned int>::max();
 
     GssMemory(unsigned int size);
+    GssMemory(std::shared_ptr<GssMemoryImage> image); //Start with the contents of the image, shared copy-on-write when possible.
     ~GssMemory();
 
     GssVariant* appendStack(); //Warning: appendStack might run the GC and thus invalidates previous GssVariants.
@@ -19,8 +73,15 @@ public:
     void popStack();
     void setStackSize(unsigned int length);
     unsigned int getStackSize();
+    GssList* getStackList(); //Direct access to the stack for the GssJit. Warning: only valid until the next allocation.
+    void* getMemoryBase() { return memory; } //For the GssJit, which follows memory positions itself. Warning: only valid until the next allocation.
 
-    GssVariant* getGlobal(unsigned int index); //Warning: getGlobal might run the GC and thus invalidates previous GssVariants.
+    //Globals are a fixed array outside of the heap, sized to the global count of the program, so they never move and a global is a single load.
+    //The GC treats them as roots.
+    void setGlobalCount(unsigned int count); //New globals are none.
+    unsigned int getGlobalCount() { return globals.size(); }
+    GssVariant* getGlobal(unsigned int index) { return &globals[index]; }
+    GssVariant* getGlobals() { return globals.data(); } //For the GssJit. Warning: only valid until the next setGlobalCount.
     
     unsigned int createString(const string& str);
     string getString(unsigned int position);
@@ -28,27 +89,126 @@ public:
     unsigned int createList(unsigned int reserved_length);
     GssVariant* appendListOnStack();
     GssVariant* getListEntry(unsigned int list_memory_position, int list_entry);
+    GssList* getList(unsigned int list_memory_position) { return (GssList*)get(list_memory_position); }
+    GssVariant* getListEntries(const GssList* list); //Without bounds checks, for iterators that check against the length themselves.
+
+    unsigned int createDictionary(unsigned int reserved_length);
+    GssDictionary* getDictionary(unsigned int dictionary_memory_position) { return (GssDictionary*)get(dictionary_memory_position); }
+    GssVariant* getDictionaryEntry(unsigned int dictionary_memory_position, uint32_t slot);
+    void addDictionarySlotOnStack(int position, uint32_t new_shape); //Move the dictionary at the stack position to a shape with one more key. Warning: might run the GC.
+    GssShapeTable& getShapes() { return shapes; }
+
+    unsigned int createArray(GssArray::ElementType element_type, unsigned int length); //Zero filled.
+    GssArray* getArray(unsigned int array_memory_position) { return (GssArray*)get(array_memory_position); }
+
+    unsigned int createVec2(double x, double y);
+    const GssVec2* getVec2(unsigned int vec2_memory_position) { return (GssVec2*)get(vec2_memory_position); }
+
+    //Scratch memory at the end of the memory block, for list literals that the compiler proved to not outlive the call that creates them.
+    //Each call reserves room for its literals and releases it on return, so these lists cost no GC work after the call.
+    //The GC never moves scratch lists, it only updates the references in them.
+    unsigned int reserveScratch(unsigned int size); //Returns the start of the reserved room. Warning: might run the GC.
+    void releaseScratch(unsigned int new_scratch_point); //Back to a [getScratchPoint] from before a reserve.
+    unsigned int getScratchPoint() { return scratch_point; }
+    unsigned int createScratchList(unsigned int position, unsigned int length); //Empty list with room for [length] entries, at a position in reserved scratch room.
     
+    //Most bytes the heap and the scratch room may use together, below the memory size. Going over it after a GC throws like running out of memory.
+    //0 removes the limit.
+    void setHeapLimit(unsigned int size);
+    unsigned int getHeapLimit() { return heap_limit; }
     unsigned int getFreeMemoryAmount();
+    GssMemoryStatistics getStatistics();
+
+    void writeSnapshot(GssSnapshotWriter& writer); //Runs the GC first, so only the live data is written.
+    //Reads the memory part of a snapshot into a new buffer and throws when it is corrupt, this memory is not changed until applySnapshot().
+    std::unique_ptr<GssMemorySnapshot> readSnapshot(GssSnapshotReader& reader);
+    void applySnapshot(std::unique_ptr<GssMemorySnapshot> snapshot);
+    std::shared_ptr<GssMemoryImage> createImage(); //Runs the GC first, so only the live data is in the image.
 
 private:
     void* memory;
+    void* spare_memory; //Zero filled buffer of memory_size that the GC copies into, the old buffer becomes the new spare after GC. Allocated on the first GC.
     unsigned int memory_size;
+    bool memory_mapped; //[memory] is a private mapping of a GssMemoryImage instead of a malloc block.
 
     unsigned int stack_location;
-    unsigned int globals_location;
+    std::vector<GssVariant> globals;
     
     unsigned int allocation_point;
+    unsigned int scratch_point;       //Start of the reserved scratch room, which runs till the end of the memory block.
+    unsigned int scratch_clear_point; //Lowest [scratch_point] since the buffer was cleared, the room below it is still zero.
+    std::vector<unsigned int> scratch_lists; //Scratch lists that the GC needs to look at, in the order they were created.
+    unsigned int heap_limit;          //Equal to [memory_size] without a limit.
+
+    GssMemoryStatistics statistics;
+    GssShapeTable shapes; //Shapes of the dictionaries in this memory, outside of the memory block as the GC never moves or frees them.
 
     unsigned int allocate(unsigned int size);
+    //Allocation for the GC copying live data: no limit check, as the live data came from this block and always fits again.
+    //The heap limit is only checked after the GC, in makeRoom().
+    unsigned int allocateForCollection(unsigned int size) { unsigned int result = allocation_point; allocation_point += ((size - 1) | 0x3) + 1; return result; }
+    //Room for [size] more bytes between the heap and the scratch room, within the heap limit.
+    bool hasRoom(unsigned int size) { return scratch_point - allocation_point >= size && uint64_t(allocation_point) + (memory_size - scratch_point) + size <= heap_limit; }
+    void makeRoom(unsigned int size); //Runs the GC, and throws when that did not free enough.
 
     void* get(unsigned int location) { return ((char*)memory) + location; }
     
     void runGarbageCollect();
+    void recycleBuffer(void* buffer, unsigned int used_size); //Called by the GC with the old buffer, to use it as next [spare_memory].
+    void freeMemoryBuffer();
     
     friend class GssGarbageCollector;
 };
 
+/*
+    Read only copy of the live data of a GssMemory, to create any number of GssMemory objects from.
+    On Linux the image is kept in a memfd that gets mapped copy-on-write, so creating a GssMemory from it
+    copies nothing, and only the pages that are written to get a private copy.
+    On other platforms the used part of the image is copied.
+*/
+class GssMemoryImage : sf::NonCopyable
+{
+public:
+    ~GssMemoryImage();
+private:
+    GssMemoryImage() : fd(-1), data(nullptr) {}
+
+    unsigned int memory_size;
+    unsigned int stack_location;
+    std::vector<GssVariant> globals;
+    unsigned int allocation_point;
+    unsigned int scratch_point;
+    std::vector<unsigned int> scratch_lists;
+    GssShapeTable shapes;
+    int fd;
+    void* data; //Only used when there is no memfd, the used part followed by the scratch room.
+
+    friend class GssMemory;
+};
+
+/*
+    Memory of a snapshot that was read, but not applied yet. The buffer is complete, so applying it never fails.
+*/
+class GssMemorySnapshot : sf::NonCopyable
+{
+public:
+    ~GssMemorySnapshot();
+    unsigned int getGlobalCount() { return globals.size(); }
+private:
+    GssMemorySnapshot() : buffer(nullptr) {}
+
+    unsigned int memory_size;
+    unsigned int stack_location;
+    std::vector<GssVariant> globals;
+    unsigned int allocation_point;
+    unsigned int scratch_point;
+    std::vector<unsigned int> scratch_lists;
+    GssShapeTable shapes;
+    void* buffer; //Zero filled memory block of [memory_size] with the heap and the scratch room in place.
+
+    friend class GssMemory;
+};
+
 class GssList
 {
 public:
@@ -57,12 +217,21 @@ public:
     uint32_t position;
 };
 
+class GssDictionary
+{
+public:
+    uint32_t shape;             //Index in the GssShapeTable, the slot count of the shape is the number of used slots.
+    uint32_t reserved_length;
+    uint32_t position;
+};
+
 class GssMemoryException : public std::exception
 {
 public:
     string message;
+    bool heap_limit; //Thrown because of the heap limit, and not because the memory block is full.
     
-    GssMemoryException(string message) : message(message) {}
+    GssMemoryException(string message, bool heap_limit = false) : message(message), heap_limit(heap_limit) {}
 };
 
 #endif//GSS_MEMORY_H
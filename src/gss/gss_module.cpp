@@ -0,0 +1,55 @@
+#include "gss_module.h"
+#include "gss_tokenizer.h"
+#include "gss_compiler.h"
+
+GssModuleCache::GssModuleCache()
+: compile_count(0)
+{
+}
+
+void GssModuleCache::setLoader(std::function<bool(const string& name, string& code)> loader)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->loader = loader;
+}
+
+void GssModuleCache::add(string name, string code)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    sources[name] = code;
+    modules.erase(name);
+}
+
+void GssModuleCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    modules.clear();
+}
+
+unsigned int GssModuleCache::getCompileCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return compile_count;
+}
+
+std::shared_ptr<const GssModule> GssModuleCache::get(const string& name)
+{
+    //Compiling a module does not import anything yet, its imports are only looked up when it is linked, so this does not nest.
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = modules.find(name);
+    if (it != modules.end())
+        return it->second;
+
+    string code;
+    auto source = sources.find(name);
+    if (source != sources.end())
+        code = source->second;
+    else if (!loader || !loader(name, code))
+        return nullptr;
+    GssTokenizer tokenizer(code);
+    GssCompiler compiler(tokenizer);
+    std::shared_ptr<const GssModule> module = compiler.compileModule(name);
+    modules[name] = module;
+    compile_count++;
+    return module;
+}
@@ -0,0 +1,45 @@
+#ifndef GSS_MODULE_H
+#define GSS_MODULE_H
+
+#include <SFML/System.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "stringImproved.h"
+
+class GssModule;
+
+/*
+    Compiled modules for `import name`, shared by all engines that have the cache set (see GssEngine::setModuleCache).
+    A module is compiled once, on its first import, and then linked into every program that imports it, which only
+    copies its code with the references moved, so a library of helpers is not compiled again for each script.
+    Modules do not depend on an engine: the names a module uses but does not define, like native functions, are found
+    by name when it is linked, in the program that imports it and in the modules the module imports itself.
+    The cache can be used from many threads at once, as by GssEngine::compileBatch(). Modules are compiled one at a time,
+    with the cache locked, so the loader is never called from two threads at once.
+*/
+class GssModuleCache : sf::NonCopyable
+{
+public:
+    GssModuleCache();
+
+    //Source for modules that were not added with add(), [loader] returns false when there is no module with that name.
+    void setLoader(std::function<bool(const string& name, string& code)> loader);
+    void add(string name, string code); //Drops the compiled module of that name, programs compiled from now on import the new code.
+    void clear(); //Drops all compiled modules, so the next import compiles them from source again.
+
+    //Compiles the module on the first call, returns nullptr when there is no module with that name.
+    //Throws the tokenizer and compiler exceptions on errors in the module.
+    std::shared_ptr<const GssModule> get(const string& name);
+    unsigned int getCompileCount();
+private:
+    std::mutex mutex;
+    std::function<bool(const string& name, string& code)> loader;
+    std::map<string, string> sources;
+    std::map<string, std::shared_ptr<const GssModule>> modules;
+    unsigned int compile_count;
+};
+
+#endif//GSS_MODULE_H
@@ -22,7 +22,7 @@ bool GssNativeFunctionCallData::isNone(unsigned int index)
     if (index >= parameter_count)
         return true;
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::none)
+    if (v->isNone())
         return true;
     return false;
 }
@@ -32,7 +32,7 @@ bool GssNativeFunctionCallData::isInt(unsigned int index)
     if (index >= parameter_count)
         return false;
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::integer)
+    if (v->isInteger())
         return true;
     return false;
 }
@@ -42,7 +42,7 @@ bool GssNativeFunctionCallData::isFloat(unsigned int index)
     if (index >= parameter_count)
         return false;
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::float_value)
+    if (v->isDouble())
         return true;
     return false;
 }
@@ -57,35 +57,69 @@ bool GssNativeFunctionCallData::isString(unsigned int index)
     if (index >= parameter_count)
         return false;
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::string)
+    if (v->is(GssVariant::Type::string))
         return true;
     return false;
 }
 
+bool GssNativeFunctionCallData::isList(unsigned int index)
+{
+    if (index >= parameter_count)
+        return false;
+    return memory->getStack(parameter_stack_position + index)->is(GssVariant::Type::list);
+}
+
+bool GssNativeFunctionCallData::isArray(unsigned int index)
+{
+    if (index >= parameter_count)
+        return false;
+    return memory->getStack(parameter_stack_position + index)->is(GssVariant::Type::array);
+}
+
+bool GssNativeFunctionCallData::isVec2(unsigned int index)
+{
+    if (index >= parameter_count)
+        return false;
+    return memory->getStack(parameter_stack_position + index)->isVec2();
+}
+
 int GssNativeFunctionCallData::getInt(unsigned int index)
+{
+    return getInt64(index);
+}
+
+int64_t GssNativeFunctionCallData::getInt64(unsigned int index)
 {
     if (index >= parameter_count)
         return 0;
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::integer)
-        return v->data.i;
+    if (v->isInteger())
+        return v->getInteger();
     return 0;
 }
 
-float GssNativeFunctionCallData::getFloat(unsigned int index)
+double GssNativeFunctionCallData::getFloat(unsigned int index)
 {
     return getNumber(index);
 }
 
-float GssNativeFunctionCallData::getNumber(unsigned int index)
+double GssNativeFunctionCallData::getNumber(unsigned int index)
+{
+    if (index >= parameter_count)
+        return 0.0;
+    GssVariant* v = memory->getStack(parameter_stack_position + index);
+    if (v->isNumber())
+        return v->toDouble();
+    return 0.0;
+}
+
+double GssNativeFunctionCallData::getDouble(unsigned int index)
 {
     if (index >= parameter_count)
         return 0.0;
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::integer)
-        return v->data.i;
-    if (v->type == GssVariant::Type::float_value)
-        return v->data.f;
+    if (v->isNumber())
+        return v->toDouble();
     return 0.0;
 }
 
@@ -94,34 +128,94 @@ string GssNativeFunctionCallData::getString(unsigned int index)
     if (index >= parameter_count)
         return "";
     GssVariant* v = memory->getStack(parameter_stack_position + index);
-    if (v->type == GssVariant::Type::string)
-        return memory->getString(v->data.i);
+    if (v->is(GssVariant::Type::string))
+        return memory->getString(v->getReference());
     return "";
 }
 
+unsigned int GssNativeFunctionCallData::getListLength(unsigned int index)
+{
+    if (!isList(index))
+        return 0;
+    return memory->getList(memory->getStack(parameter_stack_position + index)->getReference())->current_length;
+}
+
+double GssNativeFunctionCallData::getListNumber(unsigned int index, unsigned int entry)
+{
+    if (entry >= getListLength(index))
+        return 0.0;
+    GssVariant* v = memory->getListEntry(memory->getStack(parameter_stack_position + index)->getReference(), entry);
+    if (v->isNumber())
+        return v->toDouble();
+    return 0.0;
+}
+
+GssArray* GssNativeFunctionCallData::getArray(unsigned int index)
+{
+    if (!isArray(index))
+        return nullptr;
+    return memory->getArray(memory->getStack(parameter_stack_position + index)->getReference());
+}
+
+sf::Vector2f GssNativeFunctionCallData::getVec2(unsigned int index)
+{
+    if (!isVec2(index))
+        return sf::Vector2f(0, 0);
+    const GssVec2* v = memory->getVec2(memory->getStack(parameter_stack_position + index)->getReference());
+    return sf::Vector2f(v->x, v->y);
+}
+
 void GssNativeFunctionCallData::returnNone()
 {
     GssVariant* v = memory->getStack(parameter_stack_position - 1);
-    v->type = GssVariant::Type::none;
+    v->setNone();
 }
 
 void GssNativeFunctionCallData::returnInt(int i)
 {
     GssVariant* v = memory->getStack(parameter_stack_position - 1);
-    v->type = GssVariant::Type::integer;
-    v->data.i = i;
+    v->setInteger(i);
 }
 
-void GssNativeFunctionCallData::returnFloat(float f)
+void GssNativeFunctionCallData::returnFloat(double f)
 {
     GssVariant* v = memory->getStack(parameter_stack_position - 1);
-    v->type = GssVariant::Type::float_value;
-    v->data.f = f;
+    v->setDouble(f);
 }
 
-void GssNativeFunctionCallData::returnString(string s)
+void GssNativeFunctionCallData::returnInt64(int64_t i)
 {
     GssVariant* v = memory->getStack(parameter_stack_position - 1);
-    v->type = GssVariant::Type::string;
-    v->data.i = memory->createString(s);
+    v->setInteger(i);
+}
+
+void GssNativeFunctionCallData::returnDouble(double d)
+{
+    GssVariant* v = memory->getStack(parameter_stack_position - 1);
+    v->setDouble(d);
+}
+
+void GssNativeFunctionCallData::returnString(string s)
+{
+    unsigned int string_position = memory->createString(s);
+    //Get the return slot after createString, as that can GC and move the stack.
+    memory->getStack(parameter_stack_position - 1)->setReference(GssVariant::Type::string, string_position);
+}
+
+void GssNativeFunctionCallData::returnVec2(sf::Vector2f v)
+{
+    unsigned int vec2_position = memory->createVec2(v.x, v.y);
+    memory->getStack(parameter_stack_position - 1)->setReference(GssVariant::Type::vec2, vec2_position);
+}
+
+unsigned int GssNativeFunctionCallData::getMaxArrayLength()
+{
+    return (memory->getHeapLimit() - sizeof(GssArray)) / sizeof(uint32_t);
+}
+
+GssArray* GssNativeFunctionCallData::returnArray(GssArray::ElementType element_type, unsigned int length)
+{
+    unsigned int array_position = memory->createArray(element_type, length);
+    memory->getStack(parameter_stack_position - 1)->setReference(GssVariant::Type::array, array_position);
+    return memory->getArray(array_position);
 }
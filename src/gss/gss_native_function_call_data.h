@@ -3,8 +3,8 @@
 
 #include <SFML/System.hpp>
 #include "stringImproved.h"
+#include "gss_memory.h"
 
-class GssMemory;
 class GssNativeFunctionCallData : sf::NonCopyable
 {
 public:
@@ -17,16 +17,30 @@ public:
     bool isFloat(unsigned int index);
     bool isNumber(unsigned int index);
     bool isString(unsigned int index);
+    bool isList(unsigned int index);
+    bool isArray(unsigned int index);
+    bool isVec2(unsigned int index);
     
-    int getInt(unsigned int index);
-    float getFloat(unsigned int index);
-    float getNumber(unsigned int index);
+    int getInt(unsigned int index); //Deprecated: script integers have 48 bits, this truncates them to 32. Use getInt64.
+    int64_t getInt64(unsigned int index);
+    double getFloat(unsigned int index);
+    double getNumber(unsigned int index);
+    double getDouble(unsigned int index);
     string getString(unsigned int index);
+    unsigned int getListLength(unsigned int index);
+    double getListNumber(unsigned int index, unsigned int entry);
+    GssArray* getArray(unsigned int index); //nullptr if the parameter is no array. Warning: only valid until the next allocation.
+    sf::Vector2f getVec2(unsigned int index);
     
     void returnNone();
     void returnInt(int i);
-    void returnFloat(float f);
+    void returnInt64(int64_t i); //Wraps around outside of 48 bits, like all script integers.
+    void returnFloat(double f);
+    void returnDouble(double d);
     void returnString(string s);
+    void returnVec2(sf::Vector2f v);
+    GssArray* returnArray(GssArray::ElementType element_type, unsigned int length); //Zero filled array to fill in. Warning: might run the GC, which invalidates earlier GssArray pointers.
+    unsigned int getMaxArrayLength(); //Longest array that fits in the heap, returnArray() runs out of memory above this.
 private:
     unsigned int parameter_stack_position;
     unsigned int parameter_count;
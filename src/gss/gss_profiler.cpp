@@ -0,0 +1,91 @@
+#include "gss_profiler.h"
+#include "gss.h"
+
+#include <algorithm>
+#include <set>
+
+GssProfiler::GssProfiler()
+: sample_count(0)
+{
+}
+
+void GssProfiler::addSample(const std::shared_ptr<const GssProgram>& program, const std::vector<unsigned int>& stack)
+{
+    //Instruction pointers of different programs cannot be mixed, only keep the samples of the last one.
+    if (this->program != program)
+    {
+        clear();
+        this->program = program;
+    }
+    samples[stack]++;
+    sample_count++;
+}
+
+void GssProfiler::clear()
+{
+    samples.clear();
+    sample_count = 0;
+}
+
+string GssProfiler::getFlatProfile()
+{
+    class Entry
+    {
+    public:
+        unsigned int self = 0;
+        unsigned int total = 0;
+    };
+    std::map<string, Entry> entries;
+    for(auto& it : samples)
+    {
+        entries[getFrameName(it.first.back())].self += it.second;
+        //Recursive calls have the same line multiple times in a stack, it still only counts once for the total.
+        std::set<string> seen;
+        for(unsigned int instruction_pointer : it.first)
+        {
+            string name = getFrameName(instruction_pointer);
+            if (seen.insert(name).second)
+                entries[name].total += it.second;
+        }
+    }
+
+    std::vector<std::pair<string, Entry>> sorted(entries.begin(), entries.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<string, Entry>& a, const std::pair<string, Entry>& b)
+    {
+        if (a.second.self != b.second.self)
+            return a.second.self > b.second.self;
+        return a.second.total > b.second.total;
+    });
+
+    string result = "  self%  total%  samples  location\n";
+    for(auto& it : sorted)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%7.2f %7.2f %8d  ", it.second.self * 100.0f / sample_count, it.second.total * 100.0f / sample_count, it.second.self);
+        result += string(buffer) + it.first + "\n";
+    }
+    return result;
+}
+
+string GssProfiler::getFoldedStacks()
+{
+    string result;
+    for(auto& it : samples)
+    {
+        for(unsigned int index=0; index<it.first.size(); index++)
+        {
+            if (index > 0)
+                result += ";";
+            result += getFrameName(it.first[index]);
+        }
+        result += " " + string(int(it.second)) + "\n";
+    }
+    return result;
+}
+
+string GssProfiler::getFrameName(unsigned int instruction_pointer)
+{
+    int function_index = program->debug_info.getFunctionIndex(instruction_pointer);
+    string name = function_index < 0 ? string("<global>") : program->functions[function_index].name;
+    return name + ":" + string(program->debug_info.getLine(instruction_pointer));
+}
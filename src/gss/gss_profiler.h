@@ -0,0 +1,40 @@
+#ifndef GSS_PROFILER_H
+#define GSS_PROFILER_H
+
+#include <SFML/System.hpp>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "stringImproved.h"
+
+class GssProgram;
+
+/*
+    Collects call stack samples taken by the GssEngine (see GssEngine::setProfiler).
+    Samples are stored as instruction pointers, they are only mapped to function names and
+    source lines when a report is requested, so taking a sample is cheap.
+*/
+class GssProfiler : sf::NonCopyable
+{
+public:
+    GssProfiler();
+
+    //[stack] has the outermost call first and the current instruction pointer last.
+    void addSample(const std::shared_ptr<const GssProgram>& program, const std::vector<unsigned int>& stack);
+    void clear();
+    unsigned int getSampleCount() { return sample_count; }
+
+    //Table of source lines, sorted on the samples in that line itself (self) and with the functions called from that line included (total).
+    string getFlatProfile();
+    //One line per unique call stack as "frame;frame;frame count", the folded stack format that flamegraph.pl and speedscope read.
+    string getFoldedStacks();
+private:
+    std::shared_ptr<const GssProgram> program;
+    std::map<std::vector<unsigned int>, unsigned int> samples;
+    unsigned int sample_count;
+
+    string getFrameName(unsigned int instruction_pointer);
+};
+
+#endif//GSS_PROFILER_H
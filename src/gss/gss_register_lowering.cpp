@@ -0,0 +1,165 @@
+#include "gss_register_lowering.h"
+
+#include <algorithm>
+
+GssRegisterLowering::GssRegisterLowering(std::vector<GssInstruction>& instructions, std::vector<GssFunctionInfo>& functions, std::vector<int>& instruction_lines)
+: instructions(instructions), functions(functions), instruction_lines(instruction_lines)
+{
+}
+
+void GssRegisterLowering::run()
+{
+    //Find which function body each instruction belongs to.
+    std::vector<int> body_function;
+    body_function.resize(instructions.size(), -1);
+    std::vector<int> local_count;
+    for(unsigned int function_index=0; function_index<functions.size(); function_index++)
+    {
+        local_count.push_back(0);
+        for(unsigned int index=functions[function_index].address; index<functions[function_index].end_address; index++)
+        {
+            body_function[index] = function_index;
+            if (instructions[index].type == GssInstruction::Type::ensure_locals)
+                local_count.back() = std::max(local_count.back(), instructions[index].data.i);
+        }
+    }
+
+    //Symbolic stack entries cannot cross a jump target, as the other path has them on the real stack.
+    std::vector<bool> jump_target;
+    jump_target.resize(instructions.size() + 1, false);
+    for(const GssInstruction& instruction : instructions)
+        if (instruction.isJump())
+            jump_target[instruction.data.i] = true;
+
+    std::vector<unsigned int> new_index;
+    new_index.resize(instructions.size() + 1);
+    std::vector<int> result_lines;
+    unsigned int entry_index = 0;
+    for(unsigned int index=0; index<instructions.size(); index++)
+    {
+        int function_index = body_function[index];
+        if (jump_target[index] || function_index < 0)
+            flush();
+        if (function_index > -1 && functions[function_index].address == index)
+        {
+            temporary_base = local_count[function_index];
+            slot_count = temporary_base;
+            entry_index = result.size();
+        }
+        new_index[index] = result.size();
+        if (function_index > -1)
+            lowerInstruction(instructions[index]);
+        else
+            result.push_back(instructions[index]);
+        if (function_index > -1 && (index + 1 == instructions.size() || body_function[index + 1] != function_index))
+        {
+            flush();
+            //Reserve the slots for the temporaries together with the locals at the start of the function. Stubs of lazy functions have no locals yet.
+            if (result[entry_index].type == GssInstruction::Type::ensure_locals)
+                result[entry_index].data.i = slot_count;
+        }
+        result_lines.resize(result.size(), instruction_lines[index]);
+    }
+    new_index[instructions.size()] = result.size();
+
+    for(GssInstruction& instruction : result)
+        if (instruction.isJump())
+            instruction.data.i = new_index[instruction.data.i];
+    for(GssFunctionInfo& function : functions)
+    {
+        function.address = new_index[function.address];
+        function.end_address = new_index[function.end_address];
+    }
+    instructions = result;
+    instruction_lines = result_lines;
+}
+
+void GssRegisterLowering::lowerInstruction(const GssInstruction& instruction)
+{
+    switch(instruction.type)
+    {
+    case GssInstruction::Type::push_local_by_index:
+        if (instruction.data.i <= GssInstruction::max_register && pushOperand(Operand::Kind::local, instruction.data.i))
+            return;
+        break;
+    case GssInstruction::Type::push_int:
+        if (instruction.data.i >= -0x800000 && instruction.data.i < 0x800000 && pushOperand(Operand::Kind::constant, instruction.data.i))
+            return;
+        break;
+    case GssInstruction::Type::pop:
+        if (operands.size() > 0)
+        {
+            operands.pop_back();
+            return;
+        }
+        break;
+    case GssInstruction::Type::assign_local_by_index:
+        //Only a single pending entry, else entries below could still need the old value of this local.
+        if (operands.size() == 1 && instruction.data.i <= GssInstruction::max_register)
+        {
+            Operand& operand = operands.back();
+            if (operand.kind == Operand::Kind::temporary && operand.producer == int(result.size()) - 1)
+                result.back().setRegisterTarget(instruction.data.i);
+            else if (operand.kind == Operand::Kind::constant)
+                result.push_back(GssInstruction::registerLoadInt(instruction.data.i, operand.value));
+            else
+                result.push_back(GssInstruction::registerOperation(GssInstruction::Type::local_move, instruction.data.i, operand.value));
+            operands.pop_back();
+            return;
+        }
+        break;
+    default:
+        {
+            GssInstruction::Type register_type = GssInstruction::getRegisterOperation(instruction.type);
+            if (register_type != GssInstruction::Type::nop && operands.size() >= 2)
+            {
+                unsigned int operand_index = operands.size() - 2;
+                int target = temporary_base + operand_index;
+                int a = getOperandSlot(operand_index);
+                int b = getOperandSlot(operand_index + 1);
+                result.push_back(GssInstruction::registerOperation(register_type, target, a, b));
+                slot_count = std::max(slot_count, target + 1);
+                operands.pop_back();
+                operands.back() = {Operand::Kind::temporary, target, int(result.size()) - 1};
+                return;
+            }
+        }
+        break;
+    }
+    flush();
+    result.push_back(instruction);
+}
+
+bool GssRegisterLowering::pushOperand(Operand::Kind kind, int value)
+{
+    //Every pending entry can need a temporary slot, which needs to be addressable.
+    if (temporary_base + int(operands.size()) > GssInstruction::max_register)
+        return false;
+    operands.push_back({kind, value, -1});
+    return true;
+}
+
+int GssRegisterLowering::getOperandSlot(unsigned int operand_index)
+{
+    Operand& operand = operands[operand_index];
+    if (operand.kind == Operand::Kind::constant)
+    {
+        int slot = temporary_base + operand_index;
+        result.push_back(GssInstruction::registerLoadInt(slot, operand.value));
+        slot_count = std::max(slot_count, slot + 1);
+        operand = {Operand::Kind::temporary, slot, int(result.size()) - 1};
+    }
+    return operand.value;
+}
+
+void GssRegisterLowering::flush()
+{
+    for(const Operand& operand : operands)
+    {
+        if (operand.kind == Operand::Kind::constant)
+            result.emplace_back(GssInstruction::Type::push_int, operand.value);
+        else
+            result.emplace_back(GssInstruction::Type::push_local_by_index, operand.value);
+    }
+    operands.clear();
+}
@@ -0,0 +1,52 @@
+#ifndef GSS_REGISTER_LOWERING_H
+#define GSS_REGISTER_LOWERING_H
+
+#include "gss_instructions.h"
+
+/*
+    The GssRegisterLowering rewrites the stack based instructions of script function bodies
+    into three-address instructions that work directly on local variable slots.
+    So "a = b + c" becomes a single local_add instead of 4 stack instructions.
+    
+    Stack entries are tracked symbolically while possible. Temporary results get their own
+    slots after the locals of the function. Anything that cannot be expressed with the
+    three-address instructions gets its symbolic entries pushed on the real stack first,
+    so the remaining stack instructions work unchanged.
+*/
+class GssRegisterLowering
+{
+public:
+    GssRegisterLowering(std::vector<GssInstruction>& instructions, std::vector<GssFunctionInfo>& functions, std::vector<int>& instruction_lines);
+    
+    void run();
+private:
+    class Operand
+    {
+    public:
+        enum class Kind
+        {
+            local,
+            temporary,
+            constant
+        };
+        Kind kind;
+        int value;      //Local slot or constant value.
+        int producer;   //Index of the instruction in [result] that calculated a temporary.
+    };
+
+    std::vector<GssInstruction>& instructions;
+    std::vector<GssFunctionInfo>& functions;
+    std::vector<int>& instruction_lines;
+    
+    std::vector<GssInstruction> result;
+    std::vector<Operand> operands;
+    int temporary_base;
+    int slot_count;
+    
+    void lowerInstruction(const GssInstruction& instruction);
+    bool pushOperand(Operand::Kind kind, int value);
+    int getOperandSlot(unsigned int operand_index);
+    void flush();
+};
+
+#endif//GSS_REGISTER_LOWERING_H
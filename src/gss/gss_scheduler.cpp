@@ -0,0 +1,101 @@
+#include "gss_scheduler.h"
+#include "gss.h"
+
+#include <algorithm>
+#include <cmath>
+
+GssScheduler::GssScheduler(double tick_length, uint64_t instruction_slice)
+: tick_length(tick_length), instruction_slice(instruction_slice), pending_time(0.0), current_tick(0), next_generation(0)
+{
+}
+
+void GssScheduler::add(GssEngine* engine)
+{
+    uint64_t generation = next_generation++;
+    generations[engine] = generation;
+    ready.push_back({engine, generation, current_tick});
+}
+
+void GssScheduler::remove(GssEngine* engine)
+{
+    generations.erase(engine);
+}
+
+void GssScheduler::update(double delta)
+{
+    pending_time += delta;
+    while(pending_time >= tick_length)
+    {
+        pending_time -= tick_length;
+        advanceTick();
+    }
+
+    //Scripts that yield or get woken up while running this list go to the next update.
+    std::vector<Task> running;
+    running.swap(ready);
+    for(Task& task : running)
+    {
+        if (!isCurrent(task))
+            continue;
+        if (!task.engine->run(instruction_slice))
+        {
+            generations.erase(task.engine);
+            continue;
+        }
+        switch(task.engine->getWaitReason())
+        {
+        case GssWaitReason::none:
+        case GssWaitReason::yield:
+            ready.push_back(task);
+            break;
+        case GssWaitReason::time:
+            {
+                //Always at least the next tick, also for zero, negative and NaN times.
+                double ticks = std::ceil(task.engine->getWaitTime() / tick_length);
+                if (!(ticks >= 1.0))
+                    ticks = 1.0;
+                task.wake_tick = current_tick + uint64_t(std::min(ticks, 1.0e15));
+                wheel[task.wake_tick % wheel_size].push_back(task);
+            }
+            break;
+        case GssWaitReason::event:
+            event_waits[task.engine->getWaitEvent()].push_back(task);
+            break;
+        }
+    }
+}
+
+void GssScheduler::signal(const string& event)
+{
+    auto it = event_waits.find(event);
+    if (it == event_waits.end())
+        return;
+    for(Task& task : it->second)
+        if (isCurrent(task))
+            ready.push_back(task);
+    event_waits.erase(it);
+}
+
+bool GssScheduler::isCurrent(const Task& task)
+{
+    auto it = generations.find(task.engine);
+    return it != generations.end() && it->second == task.generation;
+}
+
+void GssScheduler::advanceTick()
+{
+    current_tick++;
+    std::vector<Task>& slot = wheel[current_tick % wheel_size];
+    for(unsigned int index=0; index<slot.size(); )
+    {
+        if (isCurrent(slot[index]) && slot[index].wake_tick > current_tick)
+        {
+            index++;
+            continue;
+        }
+        if (isCurrent(slot[index]))
+            ready.push_back(slot[index]);
+        slot[index] = slot.back();
+        slot.pop_back();
+    }
+}
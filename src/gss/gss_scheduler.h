@@ -0,0 +1,60 @@
+#ifndef GSS_SCHEDULER_H
+#define GSS_SCHEDULER_H
+
+#include <SFML/System.hpp>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "stringImproved.h"
+
+class GssEngine;
+
+/*
+    Runs a set of script engines as cooperative tasks, driven by update() calls from the game loop.
+    A script that yields runs again on the next update. wait(seconds) puts it in a timer wheel and wait_event(name)
+    in the wait list of that event, so sleeping scripts cost nothing per tick until they are woken up.
+    The scheduler does not own the engines, remove() an engine before deleting it.
+*/
+class GssScheduler : sf::NonCopyable
+{
+public:
+    //[tick_length] is the resolution of wait(seconds), [instruction_slice] the most instructions a script runs per update.
+    GssScheduler(double tick_length = 1.0 / 60.0, uint64_t instruction_slice = 100000);
+
+    void add(GssEngine* engine); //The engine needs to have a loaded program, it runs on the next update.
+    void remove(GssEngine* engine);
+    //Advance the time by [delta] seconds, wake the scripts whose wait is over, and run all scripts that are ready.
+    void update(double delta);
+    //Wake all scripts that wait for this event, they run on the next update.
+    void signal(const string& event);
+
+    unsigned int getTaskCount() { return generations.size(); }
+    uint64_t getTick() { return current_tick; } //Number of ticks passed since the scheduler was created.
+private:
+    class Task
+    {
+    public:
+        GssEngine* engine;
+        uint64_t generation;
+        uint64_t wake_tick;
+    };
+    static constexpr unsigned int wheel_size = 256;
+
+    double tick_length;
+    uint64_t instruction_slice;
+    double pending_time; //Time passed that did not make a full tick yet.
+    uint64_t current_tick;
+    uint64_t next_generation;
+
+    //Engines in the scheduler. Queued tasks of an engine that was removed, or removed and added again, have an outdated generation and are dropped.
+    std::unordered_map<GssEngine*, uint64_t> generations;
+    std::vector<Task> ready;
+    std::vector<Task> wheel[wheel_size]; //Waiting tasks in the slot of the tick they wake up in. Tasks that wait longer than a turn of the wheel stay in their slot till their tick.
+    std::map<string, std::vector<Task>> event_waits;
+
+    bool isCurrent(const Task& task);
+    void advanceTick();
+};
+
+#endif//GSS_SCHEDULER_H
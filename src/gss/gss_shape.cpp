@@ -0,0 +1,58 @@
+#include "gss_shape.h"
+#include "gss_snapshot.h"
+
+GssShapeTable::GssShapeTable()
+{
+    shapes.push_back({no_shape, 0, 0, {}});
+}
+
+uint32_t GssShapeTable::addKey(uint32_t shape, uint32_t key)
+{
+    auto it = shapes[shape].transitions.find(key);
+    if (it != shapes[shape].transitions.end())
+        return it->second;
+    uint32_t child = shapes.size();
+    shapes.push_back({shape, key, shapes[shape].slot_count + 1, {}});
+    //Index again, the push_back can have moved the parent.
+    shapes[shape].transitions[key] = child;
+    return child;
+}
+
+uint32_t GssShapeTable::findSlot(uint32_t shape, uint32_t key) const
+{
+    //Walk towards the empty shape, only done on an inline cache miss.
+    while(shape != empty_shape)
+    {
+        if (shapes[shape].key == key)
+            return shapes[shape].slot_count - 1;
+        shape = shapes[shape].parent;
+    }
+    return no_slot;
+}
+
+void GssShapeTable::writeSnapshot(GssSnapshotWriter& writer) const
+{
+    writer.writeUInt32(shapes.size());
+    for(unsigned int index=1; index<shapes.size(); index++)
+    {
+        writer.writeUInt32(shapes[index].parent);
+        writer.writeUInt32(shapes[index].key);
+    }
+}
+
+void GssShapeTable::readSnapshot(GssSnapshotReader& reader)
+{
+    uint32_t count = reader.readUInt32();
+    if (count < 1)
+        throw GssSnapshotException("Snapshot shape table is corrupt");
+    GssShapeTable table;
+    for(uint32_t index=1; index<count; index++)
+    {
+        uint32_t parent = reader.readUInt32();
+        uint32_t key = reader.readUInt32();
+        //Children are always created after their parent, so replaying the transitions gives the same indices.
+        if (parent >= index || table.addKey(parent, key) != index)
+            throw GssSnapshotException("Snapshot shape table is corrupt");
+    }
+    shapes = std::move(table.shapes);
+}
@@ -0,0 +1,46 @@
+#ifndef GSS_SHAPE_H
+#define GSS_SHAPE_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+class GssSnapshotWriter;
+class GssSnapshotReader;
+
+/*
+    Hidden classes for dictionaries. A shape is an ordered list of keys: all dictionaries that got the same keys
+    in the same order share a shape, and the value for a key is in the same slot in each of them.
+    Shapes form a tree, adding a key moves a dictionary to the child shape for that key.
+    Keys are string table indices, as member names are always known at compile time.
+    Shapes are never removed, so a (shape, slot) pair can be cached by the instruction that looked it up.
+*/
+class GssShapeTable
+{
+public:
+    static constexpr uint32_t empty_shape = 0;
+    static constexpr uint32_t no_shape = 0xFFFFFFFF;
+    static constexpr uint32_t no_slot = 0xFFFFFFFF;
+
+    GssShapeTable();
+
+    uint32_t addKey(uint32_t shape, uint32_t key); //Shape with [key] added after the keys of [shape].
+    uint32_t findSlot(uint32_t shape, uint32_t key) const; //no_slot when the shape does not have the key.
+    uint32_t getSlotCount(uint32_t shape) const { return shapes[shape].slot_count; }
+    unsigned int size() const { return shapes.size(); }
+
+    void writeSnapshot(GssSnapshotWriter& writer) const;
+    void readSnapshot(GssSnapshotReader& reader);
+private:
+    class Shape
+    {
+    public:
+        uint32_t parent;
+        uint32_t key;           //Key added by this shape, its slot is slot_count - 1.
+        uint32_t slot_count;
+        std::unordered_map<uint32_t, uint32_t> transitions; //Key to child shape.
+    };
+    std::vector<Shape> shapes;
+};
+
+#endif//GSS_SHAPE_H
@@ -0,0 +1,52 @@
+#ifndef GSS_SNAPSHOT_H
+#define GSS_SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "stringImproved.h"
+
+/*
+    Binary blobs created by GssEngine::snapshot. Values are stored in native byte order,
+    so a snapshot can only be restored on the same platform as it was made on.
+*/
+class GssSnapshotWriter
+{
+public:
+    std::vector<uint8_t>& data;
+
+    GssSnapshotWriter(std::vector<uint8_t>& data) : data(data) {}
+
+    void writeUInt32(uint32_t value) { writeBytes(&value, sizeof(value)); }
+    void writeBytes(const void* ptr, unsigned int size) { data.insert(data.end(), (const uint8_t*)ptr, (const uint8_t*)ptr + size); }
+};
+
+class GssSnapshotException : public std::exception
+{
+public:
+    string message;
+
+    GssSnapshotException(string message) : message(message) {}
+};
+
+class GssSnapshotReader
+{
+public:
+    GssSnapshotReader(const std::vector<uint8_t>& data) : data(data), position(0) {}
+
+    uint32_t readUInt32() { uint32_t value; readBytes(&value, sizeof(value)); return value; }
+    void readBytes(void* ptr, unsigned int size)
+    {
+        if (data.size() - position < size)
+            throw GssSnapshotException("Snapshot data is truncated");
+        memcpy(ptr, &data[position], size);
+        position += size;
+    }
+    bool atEnd() { return position == data.size(); }
+private:
+    const std::vector<uint8_t>& data;
+    unsigned int position;
+};
+
+#endif//GSS_SNAPSHOT_H
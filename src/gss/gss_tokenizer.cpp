@@ -1,14 +1,28 @@
 #include "gss_tokenizer.h"
 
-GssTokenizer::GssTokenizer(string code)
+GssTokenizer::GssTokenizer(const string& code)
+: code(code)
 {
-    this->code = code;
     line_number = 1;
     indent_amount = 0;
     next.type = GssToken::Type::invalid;
     next_token_position = 0;
 }
 
+GssTokenizer::GssTokenizer(const string& code, Position position)
+: code(code)
+{
+    line_number = position.line_number;
+    indent_amount = position.indent_amount;
+    next.type = GssToken::Type::invalid;
+    next_token_position = position.offset;
+}
+
+GssTokenizer::Position GssTokenizer::getPosition()
+{
+    return {next_token_position, line_number, indent_amount};
+}
+
 GssToken& GssTokenizer::peek()
 {
     if (next.type == GssToken::Type::invalid)
@@ -70,16 +70,28 @@ public:
 class GssTokenizer
 {
 public:
-    GssTokenizer(string code);
+    //Point in the code to continue tokenizing from later, used to compile function bodies on their first call.
+    class Position
+    {
+    public:
+        unsigned int offset;
+        int line_number;
+        int indent_amount;
+    };
+
+    //The code is not copied, it needs to stay alive as long as the tokenizer.
+    GssTokenizer(const string& code);
+    GssTokenizer(const string& code, Position position);
     
     GssToken& peek();
     GssToken& get();
+    Position getPosition(); //Position after the last token returned by get(). Only valid when no token was peeked after it.
 
 private:
     int line_number;
     int indent_amount;
     unsigned int next_token_position;
-    string code;
+    const string& code;
     GssToken current;
     GssToken next;
     
@@ -1,44 +1,57 @@
 #include "gss_variant.h"
 
-bool GssVariant::isZero()
+#include <stdio.h>
+#include <stdlib.h>
+
+GssVariant::Type GssVariant::getType() const
 {
-    switch(type)
-    {
-    case Type::none:
-        return true;
-    case Type::integer:
-        return data.i == 0;
-    case Type::float_value:
-        return data.f == 0;
-    case Type::string:
-        //TODO: Zero length strings are zero.
-        return false;
-    case Type::list:
-        //TODO: Empty lists are zero.
-        return false;
-    case Type::dictionary:
-        //TODO: Empty dictionaries are zero.
-        return false;
-    case Type::script_function:
-        return false;
-    case Type::native_function:
-        return false;
-    case Type::function_return_data:
-        return false;
-    }
-    return false;
+    static constexpr Type tag_types[] = {Type::integer, Type::none, Type::string, Type::list, Type::dictionary, Type::script_function, Type::native_function};
+    uint32_t tag = getTag();
+    if (tag < integer_tag)
+        return Type::float_value;
+    if (tag == list_tag && (bits & (array_flag | vec2_flag)))
+        return (bits & array_flag) ? Type::array : Type::vec2;
+    return tag_types[tag - integer_tag];
 }
 
-string GssVariant::toString()
+void GssVariant::setReference(Type type, uint32_t reference)
 {
-    switch(type)
+    static constexpr uint32_t type_tags[] = {none_tag, integer_tag, 0, string_tag, list_tag, dictionary_tag, script_function_tag, native_function_tag, list_tag, list_tag};
+    bits = uint64_t(reference) | (uint64_t(type_tags[int(type)]) << 48);
+    if (type == Type::array)
+        bits |= array_flag;
+    if (type == Type::vec2)
+        bits |= vec2_flag;
+}
+
+bool GssVariant::isZero() const
+{
+    //Numbers first, as conditional jumps mostly test the result of a comparison.
+    if (isInteger())
+        return (bits & payload_mask) == 0;
+    if (isDouble())
+        return getDouble() == 0;
+    //TODO: Zero length strings, empty lists and empty dictionaries are zero.
+    return isNone();
+}
+
+string GssVariant::toString() const
+{
+    switch(getType())
     {
     case Type::none:
         return "[NONE]";
     case Type::integer:
-        return string(data.i);
+        return std::to_string(getInteger());
     case Type::float_value:
-        return string(data.f);
+        {
+            //Shortest form that reads back as the same double.
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.15g", getDouble());
+            if (strtod(buffer, nullptr) != getDouble())
+                snprintf(buffer, sizeof(buffer), "%.17g", getDouble());
+            return buffer;
+        }
     case Type::string:
         return "[STR]";
     case Type::list:
@@ -46,25 +59,13 @@ string GssVariant::toString()
     case Type::dictionary:
         return "[DICT]";
     case Type::script_function:
-        return "[FUNC:"+string(data.i)+"]";
+        return "[FUNC:"+string(int(getReference()))+"]";
     case Type::native_function:
-        return "[CFUNC:"+string(data.i)+"]";
-    case Type::function_return_data:
-        return "[RET]";
+        return "[CFUNC:"+string(int(getReference()))+"]";
+    case Type::array:
+        return "[ARRAY]";
+    case Type::vec2:
+        return "[VEC2]";
     }
     return "?";
 }
-
-bool GssVariant::canBeFloat()
-{
-    return type == Type::integer || type == Type::float_value;
-}
-
-float GssVariant::toFloat()
-{
-    if (type == Type::integer)
-        return data.i;
-    else if (type == Type::float_value)
-        return data.f;
-    return 0.0;
-}
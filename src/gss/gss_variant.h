@@ -2,8 +2,18 @@
 #define GSS_VARIANT_H
 
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include "stringImproved.h"
 
+/*
+    A script value in 8 bytes, NaN-boxed:
+    Numbers with a fraction are stored as plain doubles. All other types are stored in the payload of a NaN,
+    with the type in the top 16 bits and the value in the low 48 bits (48 bit integers, memory positions, function indices).
+    Hardware only creates NaNs with the top 16 bits 0x7FF8 or 0xFFF8, so the tags 0xFFF9 and up never collide with a real double.
+    The integer tag is the lowest tag, so "is this a number" is a single compare on the top 16 bits.
+    Arrays and 2D vectors share the list tag, with [array_flag] or [vec2_flag] set in the payload above the 32 bit memory position.
+*/
 class GssVariant
 {
 public:
@@ -17,23 +27,51 @@ public:
         dictionary,
         script_function,
         native_function,
-        
-        function_return_data
+        array,
+        vec2,
     };
-    union Data
-    {
-        int32_t i;
-        float f;
-        uint16_t s[2];
-    };
-    
-    Type type;
-    Data data;
-    
-    bool isZero();
-    string toString();
-    bool canBeFloat();
-    float toFloat();
+
+    static constexpr uint32_t integer_tag = 0xFFF9;
+    static constexpr uint32_t none_tag = 0xFFFA;
+    static constexpr uint32_t string_tag = 0xFFFB;
+    static constexpr uint32_t list_tag = 0xFFFC;
+    static constexpr uint32_t dictionary_tag = 0xFFFD;
+    static constexpr uint32_t script_function_tag = 0xFFFE;
+    static constexpr uint32_t native_function_tag = 0xFFFF;
+    static constexpr uint64_t array_flag = uint64_t(1) << 32;
+    static constexpr uint64_t vec2_flag = uint64_t(2) << 32;
+    static constexpr uint64_t payload_mask = 0x0000FFFFFFFFFFFFULL;
+    static constexpr uint64_t canonical_nan = 0x7FF8000000000000ULL;
+    static constexpr int64_t integer_min = -(int64_t(1) << 47);
+    static constexpr int64_t integer_max = (int64_t(1) << 47) - 1;
+
+    uint64_t bits;
+
+    Type getType() const;
+    uint32_t getTag() const { return bits >> 48; }
+    bool isNone() const { return getTag() == none_tag; }
+    bool isInteger() const { return getTag() == integer_tag; }
+    bool isDouble() const { return getTag() < integer_tag; }
+    bool isNumber() const { return getTag() <= integer_tag; }
+    bool isVec2() const { return (bits >> 32) == ((uint64_t(list_tag) << 16) | (vec2_flag >> 32)); }
+    bool is(Type type) const { return getType() == type; }
+
+    int64_t getInteger() const { return int64_t(bits << 16) >> 16; }
+    double getDouble() const { double d; memcpy(&d, &bits, sizeof(d)); return d; }
+    uint32_t getReference() const { return uint32_t(bits); } //Memory position of strings/lists, or index of functions.
+
+    void setNone() { bits = uint64_t(none_tag) << 48; }
+    void setInteger(int64_t value) { bits = (uint64_t(value) & payload_mask) | (uint64_t(integer_tag) << 48); } //Wraps around outside of 48 bits.
+    void setDouble(double value) { if (value != value) bits = canonical_nan; else memcpy(&bits, &value, sizeof(bits)); }
+    void setReference(Type type, uint32_t reference);
+
+    //Branch free checks on the type of two operands.
+    static bool bothIntegers(const GssVariant& v0, const GssVariant& v1) { return (v0.getTag() == integer_tag) & (v1.getTag() == integer_tag); }
+    static bool bothNumbers(const GssVariant& v0, const GssVariant& v1) { return (std::max(v0.bits, v1.bits) >> 48) <= integer_tag; }
+
+    bool isZero() const;
+    string toString() const;
+    double toDouble() const { return isInteger() ? double(getInteger()) : getDouble(); } //Only valid for numbers.
 };
 
 #endif//GSS_VARIANT_H